@@ -0,0 +1,499 @@
+/*
+ * ctz-json-bench.c
+ * Micro-benchmark for ctz-json. Generates a fixed corpus (small /register
+ * bodies, a large nested /sync payload, number-heavy arrays, escape-heavy
+ * and long strings, deep nesting) and times parse (malloc'd, arena, in-situ), stringify
+ * (compact and pretty), duplicate and compare on each document. Reports MB/s, allocator calls and
+ * peak heap per document as JSON on stdout, for tracking over time.
+ *
+ * malloc, calloc, realloc and free are counted by linking with --wrap:
+ *
+ * COMPILE:
+ * gcc -Wall -Wextra -O2 ctz-json-bench.c ctz-json.a -o ctz-json-bench \
+ *     -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=free
+ */
+#define _GNU_SOURCE
+#include "ctz-json.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <getopt.h>
+#include <malloc.h>
+
+#include <sys/resource.h>
+
+#define DEFAULT_TIME_MS 300 // Minimum time spent on each operation per document
+#define MAX_DOCUMENTS 64
+
+// --- Allocation Counting ---
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+static struct {
+    uint64_t calls;   // malloc, calloc and realloc
+    size_t live;      // Usable bytes currently allocated
+    size_t peak;      // High-water mark of live since the last reset
+} g_heap;
+
+void* __wrap_malloc(size_t size) {
+    void* p = __real_malloc(size);
+    g_heap.calls++;
+    if (p) g_heap.live += malloc_usable_size(p);
+    if (g_heap.live > g_heap.peak) g_heap.peak = g_heap.live;
+    return p;
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+    void* p = __real_calloc(count, size);
+    g_heap.calls++;
+    if (p) g_heap.live += malloc_usable_size(p);
+    if (g_heap.live > g_heap.peak) g_heap.peak = g_heap.live;
+    return p;
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    size_t old = ptr ? malloc_usable_size(ptr) : 0;
+    void* p = __real_realloc(ptr, size);
+    g_heap.calls++;
+    if (p) g_heap.live += malloc_usable_size(p) - old;
+    if (g_heap.live > g_heap.peak) g_heap.peak = g_heap.live;
+    return p;
+}
+
+void __wrap_free(void* ptr) {
+    if (ptr) g_heap.live -= malloc_usable_size(ptr);
+    __real_free(ptr);
+}
+
+// --- Corpus ---
+
+typedef struct {
+    char name[64];
+    char* text;
+    size_t len;
+} Document;
+
+typedef struct {
+    char* buf;
+    size_t len;
+    size_t cap;
+} TextBuf;
+
+static void text_printf(TextBuf* t, const char* fmt, ...) {
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int n = vsnprintf(t->buf + t->len, t->cap - t->len, fmt, ap);
+        va_end(ap);
+        if (n >= 0 && (size_t)n < t->cap - t->len) {
+            t->len += n;
+            return;
+        }
+        size_t cap = t->cap ? t->cap * 2 : 4096;
+        while (cap - t->len <= (size_t)n) cap *= 2;
+        char* grown = realloc(t->buf, cap);
+        if (!grown) {
+            fprintf(stderr, "Out of memory building the corpus\n");
+            exit(1);
+        }
+        t->buf = grown;
+        t->cap = cap;
+    }
+}
+
+// xorshift64*, fixed seed: the corpus is the same on every run
+static uint64_t next_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// A /register body, the most frequent document the coordinator parses
+static void gen_register(TextBuf* t) {
+    text_printf(t, "{\"unit_name\":\"unit-eu-west-0042\",\"listen_port\":19042}");
+}
+
+// A /sync body whose payload is a few thousand indented records
+static void gen_sync(TextBuf* t) {
+    static const char* const teams[] = { "storage", "compute", "network", "billing" };
+    uint64_t rng = 1;
+    text_printf(t, "{\n  \"target_unit\": \"unit-eu-west-0042\",\n  \"payload\": {\n    \"records\": [\n");
+    for (int i = 0; i < 3000; i++) {
+        uint64_t r = next_random(&rng);
+        text_printf(t,
+            "      {\n"
+            "        \"id\": %d,\n"
+            "        \"name\": \"record-%06d-%08llx\",\n"
+            "        \"tags\": [\"alpha\", \"beta\", \"shard-%d\"],\n"
+            "        \"meta\": {\n"
+            "          \"created\": %llu,\n"
+            "          \"active\": %s,\n"
+            "          \"score\": %.3f,\n"
+            "          \"owner\": { \"team\": \"%s\", \"region\": \"eu-west-%d\", \"contact\": null }\n"
+            "        }\n"
+            "      }%s\n",
+            i, i, (unsigned long long)(r & 0xffffffff), (int)(r % 16), 1700000000000ULL + (r >> 40),
+            r & 1 ? "true" : "false", (double)(r % 100000) / 1000.0, teams[r % 4], (int)(r % 3),
+            i < 2999 ? "," : "");
+    }
+    text_printf(t, "    ]\n  }\n}\n");
+}
+
+// Integers of every size, negatives, fractions and exponents
+static void gen_numbers(TextBuf* t) {
+    uint64_t rng = 2;
+    text_printf(t, "[");
+    for (int i = 0; i < 100000; i++) {
+        uint64_t r = next_random(&rng);
+        const char* sep = i ? "," : "";
+        switch (r % 6) {
+            case 0: text_printf(t, "%s%d", sep, (int)(r >> 32) % 1000); break;
+            case 1: text_printf(t, "%s%llu", sep, (unsigned long long)(r >> 20)); break;
+            case 2: text_printf(t, "%s-%d", sep, (int)((r >> 32) % 100000)); break;
+            case 3: text_printf(t, "%s%.6f", sep, (double)(r >> 40) / 977.0); break;
+            case 4: text_printf(t, "%s%.17g", sep, (double)(r >> 11) * 0x1.0p-53); break;
+            default: text_printf(t, "%s%de%d", sep, (int)((r >> 32) % 1000), (int)(r % 40) - 20); break;
+        }
+    }
+    text_printf(t, "]");
+}
+
+// Strings dense with every escape form, including surrogate pairs
+static void gen_escapes(TextBuf* t) {
+    static const char* const pieces[] = {
+        "\\n", "\\t", "\\\"", "\\\\", "\\/", "\\u00e9", "\\u4e2d", "\\ud83d\\ude00", "\\r\\n", "\\b\\f", "plain"
+    };
+    uint64_t rng = 3;
+    text_printf(t, "[");
+    for (int i = 0; i < 5000; i++) {
+        text_printf(t, "%s\"line %d:", i ? "," : "", i);
+        for (int j = 0; j < 12; j++) text_printf(t, " %s", pieces[next_random(&rng) % 11]);
+        text_printf(t, "\"");
+    }
+    text_printf(t, "]");
+}
+
+// Long log-like strings with the odd escape, where string scanning dominates
+static void gen_strings(TextBuf* t) {
+    uint64_t rng = 4;
+    text_printf(t, "[\n");
+    for (int i = 0; i < 2000; i++) {
+        text_printf(t, "%s  \"", i ? ",\n" : "");
+        int words = 20 + (int)(next_random(&rng) % 200);
+        for (int j = 0; j < words; j++) {
+            uint64_t r = next_random(&rng);
+            if (r % 50 == 0) text_printf(t, "\\n");
+            else text_printf(t, "%s%08llx", j ? " " : "", (unsigned long long)(r >> 32));
+        }
+        text_printf(t, "\"");
+    }
+    text_printf(t, "\n]\n");
+}
+
+// Arrays and objects alternating a few hundred levels down
+static void gen_deep(TextBuf* t) {
+    const int depth = 500;
+    for (int i = 0; i < depth; i++) text_printf(t, i % 2 ? "{\"level%d\":" : "[%d,", i);
+    text_printf(t, "\"bottom\"");
+    for (int i = depth - 1; i >= 0; i--) text_printf(t, i % 2 ? "}" : "]");
+}
+
+static const struct {
+    const char* name;
+    void (*generate)(TextBuf* t);
+} g_generators[] = {
+    { "register_small", gen_register },
+    { "sync_nested", gen_sync },
+    { "numbers", gen_numbers },
+    { "escapes", gen_escapes },
+    { "long_strings", gen_strings },
+    { "deep_nesting", gen_deep },
+};
+
+static Document g_documents[MAX_DOCUMENTS];
+static int g_document_count = 0;
+
+static int load_file(const char* path, Document* d) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return -1;
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    d->text = malloc(length + 1);
+    if (!d->text || fread(d->text, 1, length, f) != (size_t)length) {
+        fclose(f);
+        free(d->text);
+        return -1;
+    }
+    fclose(f);
+    d->text[length] = '\0';
+    d->len = length;
+    const char* base = strrchr(path, '/');
+    snprintf(d->name, sizeof(d->name), "%s", base ? base + 1 : path);
+    return 0;
+}
+
+// --- Measurement ---
+
+typedef enum {
+    BENCH_PARSE,
+    BENCH_PARSE_ARENA,
+    BENCH_PARSE_INSITU,
+    BENCH_STRINGIFY,
+    BENCH_STRINGIFY_PRETTY,
+    BENCH_DUPLICATE,
+    BENCH_COMPARE,
+    BENCH_COUNT
+} BenchOp;
+
+static const char* const g_op_names[BENCH_COUNT] = {
+    "parse", "parse_arena", "parse_insitu", "stringify", "stringify_pretty", "duplicate", "compare"
+};
+
+typedef struct {
+    uint64_t iterations;
+    double ns_per_doc;
+    double mb_per_s;
+    double allocs_per_doc;
+    size_t peak_heap_bytes; // Most heap one run held beyond what was live before it
+} BenchResult;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static volatile size_t g_sink; // Keeps results observable so runs are not optimized away
+static ctz_json_arena* g_arena; // Reused across parse_arena runs, as a server thread would
+static char* g_scratch;         // Writable copy of the document for parse_insitu
+
+// One run of op; parse includes ctz_json_free, parse_insitu copying the text to a scratch
+// buffer, stringify and duplicate free what they made
+static int run_once(BenchOp op, const Document* d, const ctz_json_value* tree, const ctz_json_value* copy) {
+    switch (op) {
+        case BENCH_PARSE: {
+            ctz_json_value* v = ctz_json_parse(d->text, NULL, 0);
+            if (!v) return -1;
+            g_sink += ctz_json_get_type(v);
+            ctz_json_free(v);
+            return 0;
+        }
+        case BENCH_PARSE_ARENA: {
+            ctz_json_arena_reset(g_arena);
+            ctz_json_value* v = ctz_json_parse_arena(g_arena, d->text, NULL, 0);
+            if (!v) return -1;
+            g_sink += ctz_json_get_type(v);
+            return 0;
+        }
+        case BENCH_PARSE_INSITU: {
+            memcpy(g_scratch, d->text, d->len + 1); // The parse consumes its input
+            ctz_json_arena_reset(g_arena);
+            ctz_json_value* v = ctz_json_parse_insitu(g_arena, g_scratch, NULL, 0);
+            if (!v) return -1;
+            g_sink += ctz_json_get_type(v);
+            return 0;
+        }
+        case BENCH_STRINGIFY:
+        case BENCH_STRINGIFY_PRETTY: {
+            char* s = ctz_json_stringify(tree, op == BENCH_STRINGIFY_PRETTY);
+            if (!s) return -1;
+            g_sink += (unsigned char)s[0];
+            free(s);
+            return 0;
+        }
+        case BENCH_DUPLICATE: {
+            ctz_json_value* v = ctz_json_duplicate(tree, 1);
+            if (!v) return -1;
+            g_sink += ctz_json_get_type(v);
+            ctz_json_free(v);
+            return 0;
+        }
+        case BENCH_COMPARE:
+            if (ctz_json_compare(tree, copy) != 0) return -1;
+            g_sink++;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+// Throughput is always against the document's own size, so operations compare directly
+static int measure(BenchOp op, const Document* d, const ctz_json_value* tree, const ctz_json_value* copy,
+                   int time_ms, BenchResult* out) {
+    // First run on its own for the allocation profile
+    uint64_t calls_before = g_heap.calls;
+    size_t live_before = g_heap.live;
+    g_heap.peak = g_heap.live;
+    if (run_once(op, d, tree, copy) < 0) return -1;
+    out->allocs_per_doc = (double)(g_heap.calls - calls_before);
+    out->peak_heap_bytes = g_heap.peak - live_before;
+
+    uint64_t budget = (uint64_t)time_ms * 1000000;
+    uint64_t iterations = 0, batch = 1;
+    uint64_t start = monotonic_ns(), elapsed = 0;
+    while (elapsed < budget) {
+        for (uint64_t i = 0; i < batch; i++) {
+            if (run_once(op, d, tree, copy) < 0) return -1;
+        }
+        iterations += batch;
+        elapsed = monotonic_ns() - start;
+        if (batch < (1 << 16)) batch *= 2;
+    }
+    out->iterations = iterations;
+    out->ns_per_doc = (double)elapsed / iterations;
+    out->mb_per_s = (double)d->len * iterations / (elapsed / 1e9) / 1e6;
+    return 0;
+}
+
+// --- Main ---
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options] [file.json ...]\n"
+           "  -t, --time MS          Time spent on each operation per document (default: %d)\n"
+           "  -d, --document NAME    Only run documents whose name contains NAME\n"
+           "  -w, --write-corpus DIR Write the generated corpus to DIR as NAME.json and exit\n"
+           "  -h, --help             Show this help\n"
+           "Files given as arguments are benchmarked after the generated corpus.\n",
+           prog, DEFAULT_TIME_MS);
+}
+
+static int write_corpus(const char* dir) {
+    for (int i = 0; i < g_document_count; i++) {
+        char path[PATH_MAX];
+        if (snprintf(path, sizeof(path), "%s/%s.json", dir, g_documents[i].name) >= (int)sizeof(path)) {
+            fprintf(stderr, "Corpus directory name is too long\n");
+            return -1;
+        }
+        FILE* f = fopen(path, "wb");
+        if (!f || fwrite(g_documents[i].text, 1, g_documents[i].len, f) != g_documents[i].len) {
+            fprintf(stderr, "Could not write %s: %s\n", path, strerror(errno));
+            if (f) fclose(f);
+            return -1;
+        }
+        fclose(f);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    static const struct option long_opts[] = {
+        { "time",         required_argument, NULL, 't' },
+        { "document",     required_argument, NULL, 'd' },
+        { "write-corpus", required_argument, NULL, 'w' },
+        { "help",         no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int time_ms = DEFAULT_TIME_MS;
+    const char* filter = NULL;
+    const char* corpus_dir = NULL;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "t:d:w:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 't': {
+                char* end;
+                long value = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || value < 1 || value > INT_MAX) {
+                    fprintf(stderr, "Invalid time: %s\n", optarg); return 1;
+                }
+                time_ms = (int)value;
+                break;
+            }
+            case 'd': filter = optarg; break;
+            case 'w': corpus_dir = optarg; break;
+            case 'h': print_usage(argv[0]); return 0;
+            default: print_usage(argv[0]); return 1;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(g_generators) / sizeof(g_generators[0]); i++) {
+        TextBuf t = { 0 };
+        g_generators[i].generate(&t);
+        Document* d = &g_documents[g_document_count++];
+        snprintf(d->name, sizeof(d->name), "%s", g_generators[i].name);
+        d->text = t.buf;
+        d->len = t.len;
+    }
+    if (corpus_dir) return write_corpus(corpus_dir) < 0 ? 1 : 0;
+    for (int i = optind; i < argc; i++) {
+        if (g_document_count == MAX_DOCUMENTS || load_file(argv[i], &g_documents[g_document_count]) < 0) {
+            fprintf(stderr, "Could not load %s\n", argv[i]);
+            return 1;
+        }
+        g_document_count++;
+    }
+
+    g_arena = ctz_json_arena_new(0);
+    if (!g_arena) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    int status = 0, first = 1;
+    printf("{\"time_ms\":%d,\"kernel\":\"%s\",\"documents\":[", time_ms, ctz_json_simd_kernel());
+    for (int i = 0; i < g_document_count; i++) {
+        Document* d = &g_documents[i];
+        if (filter && !strstr(d->name, filter)) continue;
+        char error[256];
+        ctz_json_value* tree = ctz_json_parse(d->text, error, sizeof(error));
+        ctz_json_value* copy = tree ? ctz_json_duplicate(tree, 1) : NULL;
+        if (!tree || !copy) {
+            fprintf(stderr, "%s: %s\n", d->name, tree ? "duplicate failed" : error);
+            ctz_json_free(tree);
+            status = 1;
+            continue;
+        }
+        ctz_json_arena_reset(g_arena);
+        if (ctz_json_compare(ctz_json_parse_arena(g_arena, d->text, NULL, 0), tree) != 0) {
+            fprintf(stderr, "%s: arena parse differs from ctz_json_parse\n", d->name);
+            status = 1;
+        }
+        g_scratch = malloc(d->len + 1);
+        if (!g_scratch) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        memcpy(g_scratch, d->text, d->len + 1);
+        ctz_json_arena_reset(g_arena);
+        if (ctz_json_compare(ctz_json_parse_insitu(g_arena, g_scratch, NULL, 0), tree) != 0) {
+            fprintf(stderr, "%s: in-situ parse differs from ctz_json_parse\n", d->name);
+            status = 1;
+        }
+        fprintf(stderr, "Benchmarking %s (%zu bytes)...\n", d->name, d->len);
+        printf("%s{\"name\":\"%s\",\"bytes\":%zu,\"operations\":{", first ? "" : ",", d->name, d->len);
+        first = 0;
+        for (int op = 0; op < BENCH_COUNT; op++) {
+            BenchResult r;
+            if (measure((BenchOp)op, d, tree, copy, time_ms, &r) < 0) {
+                fprintf(stderr, "%s: %s failed\n", d->name, g_op_names[op]);
+                status = 1;
+                continue;
+            }
+            printf("%s\"%s\":{\"iterations\":%llu,\"ns_per_doc\":%.0f,\"mb_per_s\":%.1f,"
+                   "\"allocs_per_doc\":%.0f,\"peak_heap_bytes\":%zu}",
+                   op ? "," : "", g_op_names[op], (unsigned long long)r.iterations, r.ns_per_doc,
+                   r.mb_per_s, r.allocs_per_doc, r.peak_heap_bytes);
+        }
+        printf("}}");
+        free(g_scratch);
+        ctz_json_free(copy);
+        ctz_json_free(tree);
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("],\"peak_rss_kb\":%ld}\n", usage.ru_maxrss);
+
+    ctz_json_arena_free(g_arena);
+    for (int i = 0; i < g_document_count; i++) free(g_documents[i].text);
+    return status;
+}
@@ -2,8 +2,12 @@
  * COMPILE TO STATIC LIBRARY:
  * gcc -c ctz-json.c -o ctz-json.o -O2 -Wall
  * ar rcs ctz-json.a ctz-json.o
+ *
+ * On x86 the tokenizer picks SSE2 or AVX2 scanning at load time; build with
+ * -DCTZ_JSON_NO_SIMD for the portable byte-at-a-time loops only.
  */
 
+#define _GNU_SOURCE /* strtod_l */
 #include "ctz-json.h"
 #include <stdlib.h>
 #include <string.h>
@@ -12,28 +16,282 @@
 #include <errno.h>
 #include <math.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <float.h>
+#include <locale.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(CTZ_JSON_NO_SIMD)
+#define CTZ_SIMD_X86 1
+#include <immintrin.h>
+#endif
 
 
 #define CTZ_CONTEXT_INIT_ERROR_BUFFER(ctx, buffer, size) do { (ctx)->error_buffer = buffer; (ctx)->error_buffer_size = size; if (size > 0) buffer[0] = '\0'; } while(0)
 #define CTZ_SET_ERROR(ctx, ...) do { if ((ctx)->error_buffer) snprintf((ctx)->error_buffer, (ctx)->error_buffer_size, __VA_ARGS__); } while(0)
 #define CTZ_EXPECT(ctx, ch) do { assert(*(ctx)->json == (ch)); (ctx)->json++; } while(0)
 
-//Forward Declerations
-int ctz_json_compare(const ctz_json_value* a, const ctz_json_value* b);
-ctz_json_value* ctz_json_duplicate(const ctz_json_value* value, int deep);
 
+/* --- Scanning Kernels --- */
+
+/*
+ * Two scans dominate parsing: skipping whitespace, and finding where a run
+ * of plain string bytes ends (at a quote, a backslash or a control byte,
+ * which includes the terminating NUL). Each has a scalar version and, on
+ * x86, SSE2 and AVX2 versions chosen once at load time; all return the same
+ * pointer. The vector versions only do aligned loads, which cannot cross
+ * into the page after the NUL, so they may read (never use) a few bytes
+ * either side of the string; that is why they opt out of ASan.
+ */
+
+#define CTZ_IS_WS(ch) ((ch) == ' ' || (ch) == '\t' || (ch) == '\n' || (ch) == '\r')
+
+static const char* ctz_skip_ws_scalar(const char* p) {
+    while (CTZ_IS_WS(*p)) p++;
+    return p;
+}
+
+static const char* ctz_string_run_scalar(const char* p) {
+    while (*p != '"' && *p != '\\' && (unsigned char)*p >= 0x20) p++;
+    return p;
+}
+
+#ifdef CTZ_SIMD_X86
+
+#define CTZ_NO_ASAN __attribute__((no_sanitize_address))
+
+__attribute__((target("sse2"))) CTZ_NO_ASAN
+static const char* ctz_skip_ws_sse2(const char* p) {
+    const __m128i space = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+    const __m128i lf = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+    const char* block = (const char*)((uintptr_t)p & ~(uintptr_t)15);
+    unsigned skip = (unsigned)(p - block);
+    for (;;) {
+        __m128i v = _mm_load_si128((const __m128i*)block);
+        __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, lf), _mm_cmpeq_epi8(v, cr)));
+        unsigned mask = ~(unsigned)_mm_movemask_epi8(ws) & 0xFFFFu & (0xFFFFu << skip);
+        if (mask) return block + __builtin_ctz(mask);
+        block += 16;
+        skip = 0;
+    }
+}
+
+__attribute__((target("sse2"))) CTZ_NO_ASAN
+static const char* ctz_string_run_sse2(const char* p) {
+    const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1F);
+    const char* block = (const char*)((uintptr_t)p & ~(uintptr_t)15);
+    unsigned skip = (unsigned)(p - block);
+    for (;;) {
+        __m128i v = _mm_load_si128((const __m128i*)block);
+        /* Unsigned v <= 0x1F exactly when max(v, 0x1F) == 0x1F */
+        __m128i stop = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                    _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+        unsigned mask = (unsigned)_mm_movemask_epi8(stop) & (0xFFFFu << skip);
+        if (mask) return block + __builtin_ctz(mask);
+        block += 16;
+        skip = 0;
+    }
+}
+
+__attribute__((target("avx2"))) CTZ_NO_ASAN
+static const char* ctz_skip_ws_avx2(const char* p) {
+    const __m256i space = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+    const __m256i lf = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+    const char* block = (const char*)((uintptr_t)p & ~(uintptr_t)31);
+    unsigned skip = (unsigned)(p - block);
+    for (;;) {
+        __m256i v = _mm256_load_si256((const __m256i*)block);
+        __m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab)),
+                                     _mm256_or_si256(_mm256_cmpeq_epi8(v, lf), _mm256_cmpeq_epi8(v, cr)));
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(ws) & (0xFFFFFFFFu << skip);
+        if (mask) return block + __builtin_ctz(mask);
+        block += 32;
+        skip = 0;
+    }
+}
+
+__attribute__((target("avx2"))) CTZ_NO_ASAN
+static const char* ctz_string_run_avx2(const char* p) {
+    const __m256i quote = _mm256_set1_epi8('"'), backslash = _mm256_set1_epi8('\\');
+    const __m256i ctrl = _mm256_set1_epi8(0x1F);
+    const char* block = (const char*)((uintptr_t)p & ~(uintptr_t)31);
+    unsigned skip = (unsigned)(p - block);
+    for (;;) {
+        __m256i v = _mm256_load_si256((const __m256i*)block);
+        __m256i stop = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                                       _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl), ctrl));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(stop) & (0xFFFFFFFFu << skip);
+        if (mask) return block + __builtin_ctz(mask);
+        block += 32;
+        skip = 0;
+    }
+}
+
+#endif /* CTZ_SIMD_X86 */
+
+/* Set once, before main, by ctz_select_kernels; the scalar loops until then */
+static const char* (*ctz_skip_ws)(const char* p) = ctz_skip_ws_scalar;
+static const char* (*ctz_string_run)(const char* p) = ctz_string_run_scalar;
+static const char* ctz_kernel_name = "scalar";
+
+#ifdef CTZ_SIMD_X86
+__attribute__((constructor))
+static void ctz_select_kernels(void) {
+    __builtin_cpu_init(); /* Required before __builtin_cpu_supports in a constructor */
+    if (__builtin_cpu_supports("avx2")) {
+        ctz_skip_ws = ctz_skip_ws_avx2;
+        ctz_string_run = ctz_string_run_avx2;
+        ctz_kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        ctz_skip_ws = ctz_skip_ws_sse2;
+        ctz_string_run = ctz_string_run_sse2;
+        ctz_kernel_name = "sse2";
+    }
+}
+#endif
+
+const char* ctz_json_simd_kernel(void) {
+    return ctz_kernel_name;
+}
+
+/* Keys and short values end within a few bytes: look at those inline and
+   only hand longer runs to the kernel */
+#define CTZ_STRING_INLINE_BYTES 16
+
+static inline const char* ctz_string_stop(const char* p) {
+    for (int i = 0; i < CTZ_STRING_INLINE_BYTES; i++, p++) {
+        if (*p == '"' || *p == '\\' || (unsigned char)*p < 0x20) return p;
+    }
+    return ctz_string_run(p);
+}
 
 typedef struct {
     const char* json;
     char* error_buffer;
     size_t error_buffer_size;
+    ctz_json_arena* arena; /* NULL: every node is malloc'd and freed by ctz_json_free */
+    int insitu;            /* Strings are decoded into the (writable) input and point there */
 } ctz_context;
 
+/* --- Arena --- */
+
+#define CTZ_ARENA_DEFAULT_BLOCK (64 * 1024)
+#define CTZ_ARENA_ALIGN 8 /* Enough for a double, a pointer or a size_t */
+
+typedef struct ctz_arena_block {
+    struct ctz_arena_block* next;
+    size_t size;
+    size_t used;
+} ctz_arena_block;
+
+struct ctz_json_arena {
+    ctz_arena_block* first;
+    ctz_arena_block* current;
+    size_t block_size;
+    size_t held; /* Bytes in all blocks */
+};
+
+#define CTZ_BLOCK_HEADER ((sizeof(ctz_arena_block) + CTZ_ARENA_ALIGN - 1) & ~(size_t)(CTZ_ARENA_ALIGN - 1))
+#define CTZ_BLOCK_DATA(b) ((char*)(b) + CTZ_BLOCK_HEADER)
+
+ctz_json_arena* ctz_json_arena_new(size_t block_size) {
+    ctz_json_arena* a = (ctz_json_arena*)malloc(sizeof(ctz_json_arena));
+    if (!a) return NULL;
+    a->first = NULL;
+    a->current = NULL;
+    a->block_size = block_size ? block_size : CTZ_ARENA_DEFAULT_BLOCK;
+    a->held = 0;
+    return a;
+}
+
+void ctz_json_arena_reset(ctz_json_arena* arena) {
+    if (!arena || !arena->first) return;
+    arena->current = arena->first;
+    arena->current->used = 0;
+}
+
+void ctz_json_arena_free(ctz_json_arena* arena) {
+    if (!arena) return;
+    ctz_arena_block* b = arena->first;
+    while (b) {
+        ctz_arena_block* next = b->next;
+        free(b);
+        b = next;
+    }
+    free(arena);
+}
+
+size_t ctz_json_arena_size(const ctz_json_arena* arena) {
+    return arena ? arena->held : 0;
+}
+
+static void* ctz_arena_alloc(ctz_json_arena* a, size_t size) {
+    size = (size + CTZ_ARENA_ALIGN - 1) & ~(size_t)(CTZ_ARENA_ALIGN - 1);
+    ctz_arena_block* b = a->current;
+    if (b && size <= b->size - b->used) {
+        void* p = CTZ_BLOCK_DATA(b) + b->used;
+        b->used += size;
+        return p;
+    }
+    /* Blocks after the current one are left over from before a reset; take
+       the next that fits, or put a new one in front of them */
+    ctz_arena_block* prev = b;
+    ctz_arena_block* next = b ? b->next : NULL;
+    while (next && next->size < size) {
+        prev = next;
+        next = next->next;
+    }
+    if (!next) {
+        size_t data_size = size > a->block_size ? size : a->block_size;
+        next = (ctz_arena_block*)malloc(CTZ_BLOCK_HEADER + data_size);
+        if (!next) return NULL;
+        next->size = data_size;
+        next->next = prev ? prev->next : NULL;
+        if (prev) prev->next = next;
+        else a->first = next;
+        a->held += data_size;
+    }
+    next->used = size;
+    a->current = next;
+    return CTZ_BLOCK_DATA(next);
+}
+
+static void* ctz_alloc(ctz_context* c, size_t size) {
+    return c->arena ? ctz_arena_alloc(c->arena, size) : malloc(size);
+}
+
+/* realloc for the parser. In an arena the most recent allocation grows in
+   place when its block has room; anything else is copied */
+static void* ctz_realloc(ctz_context* c, void* ptr, size_t old_size, size_t new_size) {
+    if (!c->arena) return realloc(ptr, new_size);
+    ctz_arena_block* b = c->arena->current;
+    size_t old_rounded = (old_size + CTZ_ARENA_ALIGN - 1) & ~(size_t)(CTZ_ARENA_ALIGN - 1);
+    size_t new_rounded = (new_size + CTZ_ARENA_ALIGN - 1) & ~(size_t)(CTZ_ARENA_ALIGN - 1);
+    if (ptr && b && (char*)ptr + old_rounded == CTZ_BLOCK_DATA(b) + b->used &&
+        new_rounded - old_rounded <= b->size - b->used) {
+        b->used += new_rounded - old_rounded;
+        return ptr;
+    }
+    void* p = ctz_arena_alloc(c->arena, new_size);
+    if (p && ptr) memcpy(p, ptr, old_size);
+    return p;
+}
+
+/* Error paths drop what they built; arena memory is reclaimed by the owner's reset */
+static void ctz_discard(ctz_context* c, ctz_json_value* v) {
+    if (!c->arena) ctz_json_free(v);
+}
+
 static void ctz_parse_whitespace(ctz_context* c) {
     const char *p = c->json;
-    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
-        p++;
-    c->json = p;
+    /* Most gaps are empty or one byte (", " and ": "); only longer ones pay for a kernel call */
+    if (!CTZ_IS_WS(*p)) return;
+    if (!CTZ_IS_WS(p[1])) {
+        c->json = p + 1;
+        return;
+    }
+    c->json = ctz_skip_ws(p + 2);
 }
 
 static ctz_json_value* ctz_parse_value(ctz_context* c);
@@ -42,6 +300,18 @@ static ctz_json_value* ctz_new_value(ctz_json_type type) {
     ctz_json_value* v = (ctz_json_value*)malloc(sizeof(ctz_json_value));
     if (!v) return NULL;
     v->type = type;
+    v->is_integer = 0;
+    return v;
+}
+
+static ctz_json_value* ctz_parse_new_value(ctz_context* c, ctz_json_type type) {
+    ctz_json_value* v = (ctz_json_value*)ctz_alloc(c, sizeof(ctz_json_value));
+    if (!v) {
+        CTZ_SET_ERROR(c, "Memory allocation failure");
+        return NULL;
+    }
+    v->type = type;
+    v->is_integer = 0;
     return v;
 }
 
@@ -49,62 +319,171 @@ static ctz_json_value* ctz_parse_literal(ctz_context* c, const char* literal, ct
     size_t len = strlen(literal);
     if (strncmp(c->json, literal, len) == 0) {
         c->json += len;
-        return ctz_new_value(type);
+        return ctz_parse_new_value(c, type);
     }
     CTZ_SET_ERROR(c, "Invalid literal");
     return NULL;
 }
 
+/* --- Numbers --- */
+
+/*
+ * Numbers are read in one pass that both checks the grammar and gathers up
+ * to 19 significant digits into a uint64_t with a decimal exponent. From
+ * there, most values convert exactly without strtod:
+ *  - integer literals (and the int64 value is kept as well);
+ *  - Clinger's fast path: a mantissa below 2^53 times or divided by an
+ *    exactly representable power of ten is correctly rounded by a single
+ *    IEEE multiplication or division.
+ * The rest (17+ significant digits, large exponents) go to strtod in the C
+ * locale, so a program's setlocale() never changes what "1.5" means.
+ */
+
+#define CTZ_MAX_MANTISSA_DIGITS 19 /* Any 19-digit decimal fits in a uint64_t */
+#define CTZ_MAX_EXACT_POW10 22     /* 10^22 is the largest power of ten a double holds exactly */
+
+static const double ctz_pow10[CTZ_MAX_EXACT_POW10 + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#ifdef __GLIBC__
+static locale_t ctz_c_locale;
+
+__attribute__((constructor))
+static void ctz_init_c_locale(void) {
+    ctz_c_locale = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+}
+
+static double ctz_strtod_c(const char* s, char** end) {
+    return ctz_c_locale ? strtod_l(s, end, ctz_c_locale) : strtod(s, end);
+}
+#else
+#define ctz_strtod_c strtod /* Assumes the C (or a '.') locale for LC_NUMERIC */
+#endif
+
+/* Exact conversion of mantissa * 10^exp10 when it needs no rounding beyond one IEEE operation */
+static int ctz_fast_double(uint64_t mantissa, int exp10, double* out) {
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+    if (mantissa > ((uint64_t)1 << 53)) return -1;
+    if (exp10 < -CTZ_MAX_EXACT_POW10) return -1;
+    if (exp10 > CTZ_MAX_EXACT_POW10) {
+        /* 12e30 is 12000000000e22: shift zeros into the mantissa while it stays exact */
+        while (exp10 > CTZ_MAX_EXACT_POW10) {
+            if (mantissa > ((uint64_t)1 << 53) / 10) return -1;
+            mantissa *= 10;
+            exp10--;
+        }
+    }
+    double d = (double)mantissa;
+    *out = exp10 < 0 ? d / ctz_pow10[-exp10] : d * ctz_pow10[exp10];
+    return 0;
+#else
+    (void)mantissa; (void)exp10; (void)out;
+    return -1; /* Extended-precision intermediates would round twice */
+#endif
+}
+
 static ctz_json_value* ctz_parse_number(ctz_context* c) {
     const char* p = c->json;
-    if (*p == '-') p++;
+    int negative = *p == '-';
+    uint64_t mantissa = 0;
+    int digits = 0;    /* Significant digits in mantissa */
+    int exp10 = 0;     /* Value is mantissa * 10^exp10 (before the explicit exponent) */
+    int truncated = 0; /* Nonzero digits beyond the 19th were dropped */
+    int integer_literal = 1;
+
+    if (negative) p++;
     if (*p == '0') {
         p++;
         if (*p >= '1' && *p <= '9') {
             CTZ_SET_ERROR(c, "Invalid number format: leading zero");
             return NULL;
         }
+        if (*p == '0') {
+            CTZ_SET_ERROR(c, "Invalid number format");
+            return NULL;
+        }
     } else if (*p >= '1' && *p <= '9') {
-        p++;
-        while (*p >= '0' && *p <= '9') p++;
+        for (; *p >= '0' && *p <= '9'; p++) {
+            if (digits < CTZ_MAX_MANTISSA_DIGITS) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                digits++;
+            } else {
+                exp10++;
+                truncated |= *p != '0';
+            }
+        }
     } else {
         CTZ_SET_ERROR(c, "Invalid number format");
         return NULL;
     }
     if (*p == '.') {
         p++;
-        if (!isdigit((unsigned char)*p)) {
+        integer_literal = 0;
+        if (*p < '0' || *p > '9') {
             CTZ_SET_ERROR(c, "Invalid number format: digit expected after '.'");
             return NULL;
         }
-        while (isdigit((unsigned char)*p)) p++;
+        for (; *p >= '0' && *p <= '9'; p++) {
+            if (digits < CTZ_MAX_MANTISSA_DIGITS) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                if (mantissa) digits++; /* Leading zeros of 0.00x are not significant */
+                exp10--;
+            } else {
+                truncated |= *p != '0';
+            }
+        }
     }
     if (*p == 'e' || *p == 'E') {
         p++;
+        integer_literal = 0;
+        int exp_negative = *p == '-';
         if (*p == '+' || *p == '-') p++;
-        if (!isdigit((unsigned char)*p)) {
+        if (*p < '0' || *p > '9') {
             CTZ_SET_ERROR(c, "Invalid number format: digit expected after 'e'/'E'");
             return NULL;
         }
-        while (isdigit((unsigned char)*p)) p++;
+        int exp_value = 0;
+        for (; *p >= '0' && *p <= '9'; p++) {
+            if (exp_value < 100000) exp_value = exp_value * 10 + (*p - '0'); /* Far past any double */
+        }
+        exp10 += exp_negative ? -exp_value : exp_value;
     }
 
-    errno = 0;
-    char* end;
-    double val = strtod(c->json, &end);
-    if (errno == ERANGE && (val == HUGE_VAL || val == -HUGE_VAL)) {
-        CTZ_SET_ERROR(c, "Number out of range");
-        return NULL;
-    }
-    if (p != end) {
-        CTZ_SET_ERROR(c, "Invalid number format");
-        return NULL;
+    double val;
+    int64_t integer = 0;
+    int is_integer = 0;
+    if (integer_literal && !truncated && exp10 == 0) {
+        /* -0 stays a double so that its sign survives */
+        if (!negative && mantissa <= (uint64_t)INT64_MAX) {
+            integer = (int64_t)mantissa;
+            is_integer = 1;
+        } else if (negative && mantissa != 0 && mantissa <= (uint64_t)INT64_MAX + 1) {
+            integer = mantissa == (uint64_t)INT64_MAX + 1 ? INT64_MIN : -(int64_t)mantissa;
+            is_integer = 1;
+        }
+        val = (double)mantissa; /* Correctly rounded for every uint64_t */
+        if (negative) val = -val;
+    } else if (mantissa == 0) {
+        val = negative ? -0.0 : 0.0;
+    } else if (!truncated && ctz_fast_double(mantissa, exp10, &val) == 0) {
+        if (negative) val = -val;
+    } else {
+        errno = 0;
+        val = ctz_strtod_c(c->json, NULL);
+        if (errno == ERANGE && (val == HUGE_VAL || val == -HUGE_VAL)) {
+            CTZ_SET_ERROR(c, "Number out of range");
+            return NULL;
+        }
     }
 
     c->json = p;
-    ctz_json_value* v = ctz_new_value(CTZ_JSON_NUMBER);
+    ctz_json_value* v = ctz_parse_new_value(c, CTZ_JSON_NUMBER);
     if (!v) return NULL;
-    v->u.number = val;
+    v->u.num.value = val;
+    v->u.num.integer = integer;
+    v->is_integer = is_integer;
     return v;
 }
 
@@ -141,103 +520,159 @@ static void ctz_encode_utf8(char** buffer, unsigned u) {
     }
 }
 
-static ctz_json_value* ctz_parse_string_raw(ctz_context* c, char** str, size_t* len) {
+/*
+ * In-situ form of ctz_parse_string_raw: decodes the string over its own
+ * text, which escapes only ever shrink, and terminates it where it ends (at
+ * the latest, on its closing quote). Unescaped strings are not copied at all.
+ */
+static int ctz_parse_string_insitu(ctz_context* c, char** str, size_t* len) {
+    char* start = (char*)c->json; /* Writable: the caller passed ctz_json_parse_insitu a char* */
+    char* p = start + (ctz_string_stop(start) - start);
+    unsigned u, u2;
+    char* q = p;
+    while (*p != '"') {
+        if ((unsigned char)*p < 0x20) {
+            CTZ_SET_ERROR(c, *p == '\0' ? "Missing closing quote" : "Invalid character in string");
+            return -1;
+        }
+        p++; /* Past the backslash */
+        switch (*p) {
+            case '"': *q++ = '"'; break;
+            case '\\': *q++ = '\\'; break;
+            case '/': *q++ = '/'; break;
+            case 'b': *q++ = '\b'; break;
+            case 'f': *q++ = '\f'; break;
+            case 'n': *q++ = '\n'; break;
+            case 'r': *q++ = '\r'; break;
+            case 't': *q++ = '\t'; break;
+            case 'u': {
+                const char* h = ctz_parse_hex4(p + 1, &u);
+                if (!h) {
+                    CTZ_SET_ERROR(c, "Invalid unicode hex");
+                    return -1;
+                }
+                if (u >= 0xD800 && u <= 0xDBFF) {
+                    if (h[0] != '\\' || h[1] != 'u' || !(h = ctz_parse_hex4(h + 2, &u2)) || u2 < 0xDC00 || u2 > 0xDFFF) {
+                        CTZ_SET_ERROR(c, "Invalid unicode surrogate pair");
+                        return -1;
+                    }
+                    u = (((u - 0xD800) << 10) | (u2 - 0xDC00)) + 0x10000;
+                }
+                p += (h - p) - 1; /* Onto the last hex digit */
+                ctz_encode_utf8(&q, u);
+                break;
+            }
+            default:
+                CTZ_SET_ERROR(c, "Invalid escape character");
+                return -1;
+        }
+        p++;
+        size_t run = ctz_string_stop(p) - p;
+        memmove(q, p, run);
+        q += run;
+        p += run;
+    }
+    *q = '\0';
+    *str = start;
+    *len = q - start;
+    c->json = p + 1;
+    return 0;
+}
+
+/* Decodes the string after an opening quote into a new buffer; returns 0, or -1 with the error set */
+static int ctz_parse_string_raw(ctz_context* c, char** str, size_t* len) {
+    if (c->insitu) return ctz_parse_string_insitu(c, str, len);
     const char* p = c->json;
     size_t head = 0;
     unsigned u, u2;
     *len = 0;
     *str = NULL;
 
-    while (*p != '"' && *p != '\0') {
+    for (;;) {
+        const char* run = ctz_string_stop(p);
+        head += run - p;
+        p = run;
+        if (*p == '"' || *p == '\0') break;
         if ((unsigned char)*p < 0x20) {
             CTZ_SET_ERROR(c, "Invalid character in string");
-            free(*str);
-            return NULL;
+            return -1;
         }
-        if (*p == '\\') {
-            p++;
-            switch (*p) {
-                case '"': case '\\': case '/': case 'b':
-                case 'f': case 'n': case 'r': case 't':
-                    head++;
-                    p++;
-                    break;
-                case 'u':
-                    p++;
-                    if (!(p = ctz_parse_hex4(p, &u))) {
-                         CTZ_SET_ERROR(c, "Invalid unicode hex");
-                         free(*str);
-                         return NULL;
-                    }
-                    if (u >= 0xD800 && u <= 0xDBFF) {
-                        if (*p++ != '\\' || *p++ != 'u' || !(p = ctz_parse_hex4(p, &u2)) || u2 < 0xDC00 || u2 > 0xDFFF) {
-                            CTZ_SET_ERROR(c, "Invalid unicode surrogate pair");
-                            free(*str);
-                            return NULL;
-                        }
-                        u = (((u - 0xD800) << 10) | (u2 - 0xDC00)) + 0x10000;
+        p++; /* Past the backslash */
+        switch (*p) {
+            case '"': case '\\': case '/': case 'b':
+            case 'f': case 'n': case 'r': case 't':
+                head++;
+                p++;
+                break;
+            case 'u':
+                p++;
+                if (!(p = ctz_parse_hex4(p, &u))) {
+                     CTZ_SET_ERROR(c, "Invalid unicode hex");
+                     return -1;
+                }
+                if (u >= 0xD800 && u <= 0xDBFF) {
+                    if (*p++ != '\\' || *p++ != 'u' || !(p = ctz_parse_hex4(p, &u2)) || u2 < 0xDC00 || u2 > 0xDFFF) {
+                        CTZ_SET_ERROR(c, "Invalid unicode surrogate pair");
+                        return -1;
                     }
-                    if (u <= 0x7F) head += 1;
-                    else if (u <= 0x7FF) head += 2;
-                    else if (u <= 0xFFFF) head += 3;
-                    else head += 4;
-                    break;
-                default:
-                    CTZ_SET_ERROR(c, "Invalid escape character");
-                    free(*str);
-                    return NULL;
-            }
-        } else {
-            head++;
-            p++;
+                    u = (((u - 0xD800) << 10) | (u2 - 0xDC00)) + 0x10000;
+                }
+                if (u <= 0x7F) head += 1;
+                else if (u <= 0x7FF) head += 2;
+                else if (u <= 0xFFFF) head += 3;
+                else head += 4;
+                break;
+            default:
+                CTZ_SET_ERROR(c, "Invalid escape character");
+                return -1;
         }
     }
 
     if (*p != '"') {
         CTZ_SET_ERROR(c, "Missing closing quote");
-        free(*str);
-        return NULL;
+        return -1;
     }
 
     *len = head;
-    *str = (char*)malloc(head + 1);
+    *str = (char*)ctz_alloc(c, head + 1);
     if (!(*str)) {
         CTZ_SET_ERROR(c, "Memory allocation failure");
-        return NULL;
+        return -1;
     }
     char* q = *str;
     p = c->json;
-    while (*p != '"') {
-        if (*p == '\\') {
-            p++;
-            switch (*p) {
-                case '"': *q++ = '"'; break;
-                case '\\': *q++ = '\\'; break;
-                case '/': *q++ = '/'; break;
-                case 'b': *q++ = '\b'; break;
-                case 'f': *q++ = '\f'; break;
-                case 'n': *q++ = '\n'; break;
-                case 'r': *q++ = '\r'; break;
-                case 't': *q++ = '\t'; break;
-                case 'u':
-                    p++;
-                    p = ctz_parse_hex4(p, &u) - 1;
-                    if (u >= 0xD800 && u <= 0xDBFF) {
-                        p += 3;
-                        p = ctz_parse_hex4(p, &u2) - 1;
-                        u = (((u - 0xD800) << 10) | (u2 - 0xDC00)) + 0x10000;
-                    }
-                    ctz_encode_utf8(&q, u);
-                    break;
-            }
-            p++;
-        } else {
-            *q++ = *p++;
+    for (;;) {
+        size_t run = ctz_string_stop(p) - p;
+        memcpy(q, p, run);
+        q += run;
+        p += run;
+        if (*p == '"') break;
+        p++; /* Past the backslash */
+        switch (*p) {
+            case '"': *q++ = '"'; break;
+            case '\\': *q++ = '\\'; break;
+            case '/': *q++ = '/'; break;
+            case 'b': *q++ = '\b'; break;
+            case 'f': *q++ = '\f'; break;
+            case 'n': *q++ = '\n'; break;
+            case 'r': *q++ = '\r'; break;
+            case 't': *q++ = '\t'; break;
+            case 'u':
+                p++;
+                p = ctz_parse_hex4(p, &u) - 1;
+                if (u >= 0xD800 && u <= 0xDBFF) {
+                    p += 3;
+                    p = ctz_parse_hex4(p, &u2) - 1;
+                    u = (((u - 0xD800) << 10) | (u2 - 0xDC00)) + 0x10000;
+                }
+                ctz_encode_utf8(&q, u);
+                break;
         }
+        p++;
     }
     *q = '\0';
     c->json = p + 1;
-    return ctz_new_value(CTZ_JSON_STRING);
+    return 0;
 }
 
 
@@ -384,6 +819,16 @@ static void strbuf_append(ctz_strbuf* sb, const char* str, size_t len) {
     sb->buffer[sb->size] = '\0';
 }
 
+static void strbuf_indent(ctz_strbuf* sb, int indent) {
+    static const char spaces[] = "                                                                ";
+    size_t n = (size_t)indent * 2;
+    while (n > 0) {
+        size_t chunk = n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1;
+        strbuf_append(sb, spaces, chunk);
+        n -= chunk;
+    }
+}
+
 static void ctz_stringify_value(const ctz_json_value* v, ctz_strbuf* sb, int pretty, int indent);
 
 static void ctz_stringify_string(const char* s, size_t len, ctz_strbuf* sb) {
@@ -419,7 +864,8 @@ static void ctz_stringify_value(const ctz_json_value* v, ctz_strbuf* sb, int pre
         case CTZ_JSON_TRUE:   strbuf_append(sb, "true", 4); break;
         case CTZ_JSON_FALSE:  strbuf_append(sb, "false", 5); break;
         case CTZ_JSON_NUMBER:
-            sprintf(buffer, "%.17g", v->u.number);
+            if (v->is_integer) sprintf(buffer, "%lld", (long long)v->u.num.integer);
+            else sprintf(buffer, "%.17g", v->u.number);
             strbuf_append(sb, buffer, strlen(buffer));
             break;
         case CTZ_JSON_STRING:
@@ -429,9 +875,7 @@ static void ctz_stringify_value(const ctz_json_value* v, ctz_strbuf* sb, int pre
             strbuf_append(sb, "[", 1);
             if (pretty && v->u.array.size > 0) strbuf_append(sb, "\n", 1);
             for (size_t i = 0; i < v->u.array.size; i++) {
-                if (pretty) sprintf(buffer, "%*s", (indent + 1) * 2, "");
-                else buffer[0] = '\0';
-                strbuf_append(sb, buffer, strlen(buffer));
+                if (pretty) strbuf_indent(sb, indent + 1);
 
                 ctz_stringify_value(v->u.array.e[i], sb, pretty, indent + 1);
                 
@@ -441,8 +885,7 @@ static void ctz_stringify_value(const ctz_json_value* v, ctz_strbuf* sb, int pre
                 if (pretty) strbuf_append(sb, "\n", 1);
             }
             if (pretty && v->u.array.size > 0) {
-                 sprintf(buffer, "%*s", indent * 2, "");
-                 strbuf_append(sb, buffer, strlen(buffer));
+                 strbuf_indent(sb, indent);
             }
             strbuf_append(sb, "]", 1);
             break;
@@ -450,9 +893,7 @@ static void ctz_stringify_value(const ctz_json_value* v, ctz_strbuf* sb, int pre
             strbuf_append(sb, "{", 1);
             if (pretty && v->u.object.size > 0) strbuf_append(sb, "\n", 1);
             for (size_t i = 0; i < v->u.object.size; i++) {
-                if (pretty) sprintf(buffer, "%*s", (indent + 1) * 2, "");
-                else buffer[0] = '\0';
-                strbuf_append(sb, buffer, strlen(buffer));
+                if (pretty) strbuf_indent(sb, indent + 1);
 
                 ctz_stringify_string(v->u.object.m[i].k, v->u.object.m[i].klen, sb);
                 strbuf_append(sb, pretty ? ": " : ":", pretty ? 2 : 1);
@@ -464,8 +905,7 @@ static void ctz_stringify_value(const ctz_json_value* v, ctz_strbuf* sb, int pre
                 if (pretty) strbuf_append(sb, "\n", 1);
             }
             if (pretty && v->u.object.size > 0) {
-                 sprintf(buffer, "%*s", indent * 2, "");
-                 strbuf_append(sb, buffer, strlen(buffer));
+                 strbuf_indent(sb, indent);
             }
             strbuf_append(sb, "}", 1);
             break;
@@ -559,11 +999,14 @@ static ctz_json_value* ctz_parse_string(ctz_context* c) {
     CTZ_EXPECT(c, '"');
     char* s;
     size_t len;
-    ctz_json_value* v = ctz_parse_string_raw(c, &s, &len);
-    if (v) {
-        v->u.string.s = s;
-        v->u.string.len = len;
+    if (ctz_parse_string_raw(c, &s, &len) < 0) return NULL;
+    ctz_json_value* v = ctz_parse_new_value(c, CTZ_JSON_STRING);
+    if (!v) {
+        if (!c->arena) free(s);
+        return NULL;
     }
+    v->u.string.s = s;
+    v->u.string.len = len;
     return v;
 }
 
@@ -571,7 +1014,7 @@ static ctz_json_value* ctz_parse_array(ctz_context* c) {
     CTZ_EXPECT(c, '[');
     ctz_parse_whitespace(c);
 
-    ctz_json_value* v = ctz_new_value(CTZ_JSON_ARRAY);
+    ctz_json_value* v = ctz_parse_new_value(c, CTZ_JSON_ARRAY);
     if (!v) return NULL;
     v->u.array.size = 0;
     v->u.array.e = NULL;
@@ -585,10 +1028,12 @@ static ctz_json_value* ctz_parse_array(ctz_context* c) {
     size_t capacity = 0;
     for (;;) {
         if (v->u.array.size >= capacity) {
+            size_t old_capacity = capacity;
             capacity = capacity == 0 ? 8 : capacity * 2;
-            ctz_json_value** new_e = (ctz_json_value**)realloc(v->u.array.e, capacity * sizeof(ctz_json_value*));
+            ctz_json_value** new_e = (ctz_json_value**)ctz_realloc(c, v->u.array.e, old_capacity * sizeof(ctz_json_value*),
+                                                                   capacity * sizeof(ctz_json_value*));
             if (!new_e) {
-                ctz_json_free(v);
+                ctz_discard(c, v);
                 CTZ_SET_ERROR(c, "Memory allocation failure");
                 return NULL;
             }
@@ -598,7 +1043,7 @@ static ctz_json_value* ctz_parse_array(ctz_context* c) {
 
         ctz_json_value* element = ctz_parse_value(c);
         if (!element) {
-            ctz_json_free(v);
+            ctz_discard(c, v);
             return NULL;
         }
         v->u.array.e[v->u.array.size++] = element;
@@ -611,7 +1056,7 @@ static ctz_json_value* ctz_parse_array(ctz_context* c) {
             c->json++;
             return v;
         } else {
-            ctz_json_free(v);
+            ctz_discard(c, v);
             CTZ_SET_ERROR(c, "Invalid array format");
             return NULL;
         }
@@ -622,7 +1067,7 @@ static ctz_json_value* ctz_parse_object(ctz_context* c) {
     CTZ_EXPECT(c, '{');
     ctz_parse_whitespace(c);
 
-    ctz_json_value* v = ctz_new_value(CTZ_JSON_OBJECT);
+    ctz_json_value* v = ctz_parse_new_value(c, CTZ_JSON_OBJECT);
     if (!v) return NULL;
     v->u.object.size = 0;
     v->u.object.m = NULL;
@@ -635,10 +1080,12 @@ static ctz_json_value* ctz_parse_object(ctz_context* c) {
     size_t capacity = 0;
     for (;;) {
         if (v->u.object.size >= capacity) {
+            size_t old_capacity = capacity;
             capacity = capacity == 0 ? 8 : capacity * 2;
-            ctz_json_member* new_m = (ctz_json_member*)realloc(v->u.object.m, capacity * sizeof(ctz_json_member));
+            ctz_json_member* new_m = (ctz_json_member*)ctz_realloc(c, v->u.object.m, old_capacity * sizeof(ctz_json_member),
+                                                                   capacity * sizeof(ctz_json_member));
             if (!new_m) {
-                ctz_json_free(v);
+                ctz_discard(c, v);
                 CTZ_SET_ERROR(c, "Memory allocation failure");
                 return NULL;
             }
@@ -646,22 +1093,22 @@ static ctz_json_value* ctz_parse_object(ctz_context* c) {
         }
 
         if (*c->json != '"') {
-            ctz_json_free(v);
+            ctz_discard(c, v);
             CTZ_SET_ERROR(c, "Object key must be a string");
             return NULL;
         }
 
         ctz_json_member* member = &v->u.object.m[v->u.object.size];
         CTZ_EXPECT(c, '"');
-        if (!ctz_parse_string_raw(c, &member->k, &member->klen)) {
-            ctz_json_free(v);
+        if (ctz_parse_string_raw(c, &member->k, &member->klen) < 0) {
+            ctz_discard(c, v);
             return NULL;
         }
 
         ctz_parse_whitespace(c);
         if (*c->json != ':') {
-            free(member->k);
-            ctz_json_free(v);
+            if (!c->arena) free(member->k);
+            ctz_discard(c, v);
             CTZ_SET_ERROR(c, "Missing colon after object key");
             return NULL;
         }
@@ -670,8 +1117,8 @@ static ctz_json_value* ctz_parse_object(ctz_context* c) {
 
         member->v = ctz_parse_value(c);
         if (!member->v) {
-            free(member->k);
-            ctz_json_free(v);
+            if (!c->arena) free(member->k);
+            ctz_discard(c, v);
             return NULL;
         }
         v->u.object.size++;
@@ -684,7 +1131,7 @@ static ctz_json_value* ctz_parse_object(ctz_context* c) {
             c->json++;
             return v;
         } else {
-            ctz_json_free(v);
+            ctz_discard(c, v);
             CTZ_SET_ERROR(c, "Invalid object format");
             return NULL;
         }
@@ -705,22 +1152,54 @@ static ctz_json_value* ctz_parse_value(ctz_context* c) {
     }
 }
 
-ctz_json_value* ctz_json_parse(const char* json, char* error_buffer, size_t error_buffer_size) {
-    ctz_context c;
-    c.json = json;
-    CTZ_CONTEXT_INIT_ERROR_BUFFER(&c, error_buffer, error_buffer_size);
-    ctz_json_value* value = ctz_parse_value(&c);
+static ctz_json_value* ctz_parse_document(ctz_context* c) {
+    ctz_json_value* value = ctz_parse_value(c);
     if (value) {
-        ctz_parse_whitespace(&c);
-        if (*c.json != '\0') {
-            ctz_json_free(value);
-            CTZ_SET_ERROR(&c, "Unexpected characters at end of input");
+        ctz_parse_whitespace(c);
+        if (*c->json != '\0') {
+            ctz_discard(c, value);
+            CTZ_SET_ERROR(c, "Unexpected characters at end of input");
             return NULL;
         }
     }
     return value;
 }
 
+ctz_json_value* ctz_json_parse(const char* json, char* error_buffer, size_t error_buffer_size) {
+    ctz_context c;
+    c.json = json;
+    c.arena = NULL;
+    c.insitu = 0;
+    CTZ_CONTEXT_INIT_ERROR_BUFFER(&c, error_buffer, error_buffer_size);
+    return ctz_parse_document(&c);
+}
+
+ctz_json_value* ctz_json_parse_arena(ctz_json_arena* arena, const char* json, char* error_buffer, size_t error_buffer_size) {
+    ctz_context c;
+    c.json = json;
+    c.arena = arena;
+    c.insitu = 0;
+    CTZ_CONTEXT_INIT_ERROR_BUFFER(&c, error_buffer, error_buffer_size);
+    if (!arena) {
+        CTZ_SET_ERROR(&c, "No arena");
+        return NULL;
+    }
+    return ctz_parse_document(&c);
+}
+
+ctz_json_value* ctz_json_parse_insitu(ctz_json_arena* arena, char* json, char* error_buffer, size_t error_buffer_size) {
+    ctz_context c;
+    c.json = json;
+    c.arena = arena;
+    c.insitu = 1;
+    CTZ_CONTEXT_INIT_ERROR_BUFFER(&c, error_buffer, error_buffer_size);
+    if (!arena) {
+        CTZ_SET_ERROR(&c, "No arena");
+        return NULL;
+    }
+    return ctz_parse_document(&c);
+}
+
 void ctz_json_free(ctz_json_value* value) {
     if (!value) return;
     switch (value->type) {
@@ -753,6 +1232,18 @@ double ctz_json_get_number(const ctz_json_value* value) {
     return (value && value->type == CTZ_JSON_NUMBER) ? value->u.number : 0.0;
 }
 
+int ctz_json_get_int64(const ctz_json_value* value, int64_t* out) {
+    if (!value || value->type != CTZ_JSON_NUMBER) return -1;
+    if (value->is_integer) {
+        *out = value->u.num.integer;
+        return 0;
+    }
+    double d = value->u.number;
+    if (d != floor(d) || d < -9223372036854775808.0 || d >= 9223372036854775808.0) return -1;
+    *out = (int64_t)d;
+    return 0;
+}
+
 const char* ctz_json_get_string(const ctz_json_value* value) {
     return (value && value->type == CTZ_JSON_STRING) ? value->u.string.s : "";
 }
@@ -807,6 +1298,140 @@ ctz_json_value* ctz_json_find_object_value(const ctz_json_value* value, const ch
     return NULL;
 }
 
+/* --- Member scan (no tree) --- */
+
+static const char* ctz_scan_whitespace(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    return p;
+}
+
+/* p is just past the opening quote; returns just past the closing one */
+static const char* ctz_scan_string_end(const char* p, const char* end) {
+    while (p < end) {
+        if (*p == '"') return p + 1;
+        if (*p == '\\') p++;
+        p++;
+    }
+    return NULL;
+}
+
+/* Skips one value, balancing brackets and skipping strings; scalars are not validated */
+static const char* ctz_scan_value_end(const char* p, const char* end) {
+    if (p >= end) return NULL;
+    if (*p == '"') return ctz_scan_string_end(p + 1, end);
+    if (*p != '{' && *p != '[') {
+        while (p < end && *p != ',' && *p != '}' && *p != ']' &&
+               *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') p++;
+        return p;
+    }
+    size_t depth = 0;
+    while (p < end) {
+        char ch = *p++;
+        if (ch == '"') {
+            if (!(p = ctz_scan_string_end(p, end))) return NULL;
+        } else if (ch == '{' || ch == '[') {
+            depth++;
+        } else if (ch == '}' || ch == ']') {
+            if (--depth == 0) return p;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Decodes the string body starting just past its opening quote into out.
+ * Returns the decoded length, -1 if it does not fit (with its NUL), or -2
+ * if it is malformed. *next is set just past the closing quote.
+ */
+static int ctz_scan_decode(const char* p, const char* end, char* out, size_t out_size, const char** next) {
+    size_t n = 0;
+    char utf8[4];
+    int overflow = 0;
+    while (p < end && *p != '"') {
+        const char* bytes = p;
+        size_t count = 1;
+        if ((unsigned char)*p < 0x20) return -2;
+        if (*p == '\\') {
+            if (++p >= end) return -2;
+            switch (*p) {
+                case '"': case '\\': case '/': bytes = p; break;
+                case 'b': bytes = "\b"; break;
+                case 'f': bytes = "\f"; break;
+                case 'n': bytes = "\n"; break;
+                case 'r': bytes = "\r"; break;
+                case 't': bytes = "\t"; break;
+                case 'u': {
+                    unsigned u, u2;
+                    if (end - p < 5 || !ctz_parse_hex4(p + 1, &u)) return -2;
+                    p += 4;
+                    if (u >= 0xD800 && u <= 0xDBFF) {
+                        if (end - p < 7 || p[1] != '\\' || p[2] != 'u' || !ctz_parse_hex4(p + 3, &u2) ||
+                            u2 < 0xDC00 || u2 > 0xDFFF) return -2;
+                        u = (((u - 0xD800) << 10) | (u2 - 0xDC00)) + 0x10000;
+                        p += 6;
+                    }
+                    char* q = utf8;
+                    ctz_encode_utf8(&q, u);
+                    bytes = utf8;
+                    count = q - utf8;
+                    break;
+                }
+                default: return -2;
+            }
+        }
+        p++;
+        if (n + count < out_size) memcpy(out + n, bytes, count);
+        else overflow = 1;
+        n += count;
+    }
+    if (p >= end) return -2;
+    *next = p + 1;
+    if (overflow) return -1;
+    out[n] = '\0';
+    return (int)n;
+}
+
+int ctz_json_scan_string_member(const char* json, size_t len, const char* key, char* out, size_t out_size) {
+    const char* end = json + len;
+    size_t key_len = strlen(key);
+    const char* p = ctz_scan_whitespace(json, end);
+    if (p >= end || *p != '{' || out_size == 0) return -2;
+    p = ctz_scan_whitespace(p + 1, end);
+    if (p < end && *p == '}') return -1;
+
+    char* name = (char*)malloc(key_len + 1);
+    if (!name) return -2;
+    int result = -1;
+    for (;;) {
+        if (p >= end || *p != '"') { result = -2; break; }
+        int name_len = ctz_scan_decode(p + 1, end, name, key_len + 1, &p);
+        if (name_len == -2) { result = -2; break; }
+        int match = name_len == (int)key_len && memcmp(name, key, key_len) == 0;
+
+        p = ctz_scan_whitespace(p, end);
+        if (p >= end || *p != ':') { result = -2; break; }
+        p = ctz_scan_whitespace(p + 1, end);
+
+        if (match) {
+            if (p < end && *p == '"') {
+                int n = ctz_scan_decode(p + 1, end, out, out_size, &p);
+                result = n == -1 ? -1 : n;
+            }
+            break; /* First occurrence wins, as with ctz_json_find_object_value */
+        }
+        if (!(p = ctz_scan_value_end(p, end))) { result = -2; break; }
+        p = ctz_scan_whitespace(p, end);
+        if (p < end && *p == ',') {
+            p = ctz_scan_whitespace(p + 1, end);
+        } else {
+            result = (p < end && *p == '}') ? -1 : -2;
+            break;
+        }
+    }
+    free(name);
+    return result;
+}
+
 int ctz_json_compare(const ctz_json_value* a, const ctz_json_value* b) {
     if (a == b) return 0; // Same pointer
     if (!a || !b) return 1; // One is null
@@ -814,7 +1439,9 @@ int ctz_json_compare(const ctz_json_value* a, const ctz_json_value* b) {
 
     switch (a->type) {
         case CTZ_JSON_NUMBER:
-            return a->u.number == b->u.number ? 0 : 1;
+            /* Integers past 2^53 can share a double, so exact ones compare exactly */
+            return (a->u.number != b->u.number) |
+                   (a->is_integer & b->is_integer & (a->u.num.integer != b->u.num.integer));
         case CTZ_JSON_STRING:
             if (a->u.string.len != b->u.string.len) return 1;
             return memcmp(a->u.string.s, b->u.string.s, a->u.string.len);
@@ -853,7 +1480,13 @@ ctz_json_value* ctz_json_duplicate(const ctz_json_value* value, int deep) {
         case CTZ_JSON_NULL:   new_val = ctz_json_new_null(); break;
         case CTZ_JSON_TRUE:   new_val = ctz_json_new_bool(1); break;
         case CTZ_JSON_FALSE:  new_val = ctz_json_new_bool(0); break;
-        case CTZ_JSON_NUMBER: new_val = ctz_json_new_number(value->u.number); break;
+        case CTZ_JSON_NUMBER:
+            new_val = ctz_json_new_number(value->u.number);
+            if (new_val && value->is_integer) {
+                new_val->u.num.integer = value->u.num.integer;
+                new_val->is_integer = 1;
+            }
+            break;
         case CTZ_JSON_STRING: new_val = ctz_json_new_string(value->u.string.s); break;
         case CTZ_JSON_ARRAY:
             new_val = ctz_json_new_array();
@@ -14,6 +14,7 @@
 #define CTZ_JSON_H
 
 #include <stddef.h> /* size_t */
+#include <stdint.h> /* int64_t */
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,15 +32,18 @@ typedef enum {
 
 typedef struct ctz_json_value ctz_json_value;
 typedef struct ctz_json_member ctz_json_member;
+typedef struct ctz_json_arena ctz_json_arena;
 
 struct ctz_json_value {
     union {
         double number;
+        struct { double value; int64_t integer; } num; /* value aliases number; integer is set when is_integer */
         struct { char* s; size_t len; } string;
         struct { ctz_json_value** e; size_t size; size_t capacity; } array;
         struct { ctz_json_member* m; size_t size; } object;
     } u;
     ctz_json_type type;
+    int is_integer; /* A number parsed from an integer literal that fits int64_t, kept exactly */
 };
 
 struct ctz_json_member {
@@ -52,10 +56,53 @@ ctz_json_value* ctz_json_parse(const char* json, char* error_buffer, size_t erro
 
 void ctz_json_free(ctz_json_value* value);
 
+/*
+ * Bump arena for ctz_json_parse_arena. Memory comes from blocks of
+ * block_size bytes (0 for 64 KB); larger requests get a block of their own.
+ * Reset rewinds to the first block in O(1) and keeps every block for reuse,
+ * which invalidates every tree parsed from the arena. An arena is not
+ * thread-safe: keep one per thread.
+ */
+ctz_json_arena* ctz_json_arena_new(size_t block_size);
+void ctz_json_arena_reset(ctz_json_arena* arena);
+void ctz_json_arena_free(ctz_json_arena* arena);
+size_t ctz_json_arena_size(const ctz_json_arena* arena); /* Bytes held in blocks */
+
+/*
+ * Parses like ctz_json_parse, but takes every node, member array and string
+ * from arena: one allocation per block rather than several per value. The
+ * read accessors work as usual. The tree lives until the arena is reset or
+ * freed; never pass it (or any part of it) to ctz_json_free or the
+ * modifying functions. A failed parse leaves its memory in the arena until
+ * the next reset.
+ */
+ctz_json_value* ctz_json_parse_arena(ctz_json_arena* arena, const char* json, char* error_buffer, size_t error_buffer_size);
+
+/*
+ * Parses like ctz_json_parse_arena, but strings and keys are not copied:
+ * they are decoded in place over the text of json and point into it, so
+ * only nodes and member arrays come from the arena.
+ *
+ * Lifetime contract: json must be writable and NUL-terminated, and it is
+ * modified (each string is terminated where its closing quote was, escaped
+ * ones are shortened in place), even if the parse fails. The tree is valid
+ * while both json and the arena are, i.e. until the buffer is freed or
+ * reused or the arena is reset. To keep anything longer, copy it out:
+ * ctz_json_duplicate(value, 1) makes an independent malloc'd tree.
+ */
+ctz_json_value* ctz_json_parse_insitu(ctz_json_arena* arena, char* json, char* error_buffer, size_t error_buffer_size);
+
 ctz_json_type ctz_json_get_type(const ctz_json_value* value);
 
 double ctz_json_get_number(const ctz_json_value* value);
 
+/*
+ * Stores a number's exact value if it is an integer that fits int64_t and
+ * returns 0; -1 otherwise. Integer literals keep every digit, even past
+ * 2^53 where the double from ctz_json_get_number is rounded.
+ */
+int ctz_json_get_int64(const ctz_json_value* value, int64_t* out);
+
 const char* ctz_json_get_string(const ctz_json_value* value);
 size_t ctz_json_get_string_length(const ctz_json_value* value);
 
@@ -68,6 +115,19 @@ size_t ctz_json_get_object_key_length(const ctz_json_value* value, size_t index)
 ctz_json_value* ctz_json_get_object_value(const ctz_json_value* value, size_t index);
 ctz_json_value* ctz_json_find_object_value(const ctz_json_value* value, const char* key);
 
+/*
+ * Reads the string member `key` of a top-level object straight from the
+ * text, without building a tree: other members are only skipped (strings
+ * and bracket nesting are tracked, scalars are not validated). Decodes the
+ * value into out and returns its length; -1 if the key is absent, its value
+ * is not a string or does not fit out_size; -2 if the text is malformed
+ * before the member is found.
+ */
+int ctz_json_scan_string_member(const char* json, size_t len, const char* key, char* out, size_t out_size);
+
+/* Name of the scanning kernels in use: "avx2", "sse2" or "scalar" */
+const char* ctz_json_simd_kernel(void);
+
 ctz_json_value* ctz_json_load_file(const char* filepath, char* error_buffer, size_t error_buffer_size);
 
 
@@ -77,6 +137,12 @@ int ctz_json_object_set_value(ctz_json_value* object, const char* key, ctz_json_
 
 int ctz_json_object_remove_value(ctz_json_value* object, const char* key);
 
+/* Returns 0 if a and b hold the same JSON (object members in any order), nonzero otherwise */
+int ctz_json_compare(const ctz_json_value* a, const ctz_json_value* b);
+
+/* Copies value; a shallow copy of an array or object is empty. Free with ctz_json_free */
+ctz_json_value* ctz_json_duplicate(const ctz_json_value* value, int deep);
+
 ctz_json_value* ctz_json_new_null(void);
 ctz_json_value* ctz_json_new_bool(int b);
 ctz_json_value* ctz_json_new_number(double n);
@@ -0,0 +1,649 @@
+/*
+ * exodus-bench.c
+ * Load generator for the Exodus coordinator. Registers a registry's worth
+ * of units pointing at exodus-stub-unit, then drives a weighted mix of
+ * /register, /resolve, /units, /nodes and /sync requests from a number of
+ * keep-alive client threads over loopback, and prints throughput and
+ * latency percentiles as JSON on stdout (progress goes to stderr).
+ *
+ * COMPILE:
+ * gcc -Wall -Wextra -O2 exodus-bench.c -o exodus-bench -pthread
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_COORDINATOR_PORT 8080
+#define DEFAULT_STUB_PORT 19000
+#define DEFAULT_UNITS 1000
+#define DEFAULT_CONCURRENCY 32
+#define DEFAULT_DURATION_SECONDS 10
+#define DEFAULT_WARMUP_SECONDS 1
+#define DEFAULT_SYNC_BYTES 256
+#define REGISTER_BATCH 10000 // The coordinator's cap on one POST /register/batch
+#define CLIENT_BUFFER_SIZE (64 * 1024)
+#define CONNECT_WAIT_MS 10000 // How long to wait for the coordinator to come up
+
+// Latency histogram (microseconds): exact below 64, then 32 buckets per
+// power of two, so any reported percentile is within about 3%
+#define HIST_SUB_BITS 5
+#define HIST_EXACT 64
+#define HIST_MAX_SHIFT 40
+#define HIST_BUCKETS (HIST_EXACT + (HIST_MAX_SHIFT - 6) * (1 << HIST_SUB_BITS))
+
+typedef enum {
+    OP_REGISTER,
+    OP_RESOLVE,
+    OP_UNITS,
+    OP_NODES,
+    OP_SYNC,
+    OP_COUNT
+} Op;
+
+static const char* const g_op_names[OP_COUNT] = { "register", "resolve", "units", "nodes", "sync" };
+
+static struct {
+    char host[64];
+    int port;
+    int stub_port;
+    int stub_ports;
+    int units;
+    int concurrency;
+    int duration_seconds;
+    int warmup_seconds;
+    int sync_bytes;
+    int weights[OP_COUNT];
+    uint64_t seed;
+    int skip_setup;
+} g_config = {
+    "127.0.0.1", DEFAULT_COORDINATOR_PORT, DEFAULT_STUB_PORT, 1, DEFAULT_UNITS, DEFAULT_CONCURRENCY,
+    DEFAULT_DURATION_SECONDS, DEFAULT_WARMUP_SECONDS, DEFAULT_SYNC_BYTES, { 40, 30, 5, 15, 10 }, 1, 0
+};
+
+typedef struct {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max_us;
+} Histogram;
+
+typedef struct {
+    Histogram latency[OP_COUNT];
+    uint64_t errors[OP_COUNT]; // Non-2xx answers and broken connections
+    uint64_t reconnects;
+} ThreadStats;
+
+typedef struct {
+    int fd; // -1 while disconnected
+    char buf[CLIENT_BUFFER_SIZE];
+    size_t len;
+} Client;
+
+typedef struct {
+    int index;
+    pthread_t thread;
+    ThreadStats stats;
+} Worker;
+
+static struct sockaddr_in g_coordinator;
+static _Atomic int g_recording = 0;
+static _Atomic int g_stopping = 0;
+static char* g_sync_payload = NULL;
+
+// --- Utility Functions ---
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// xorshift64*: per-thread and seeded, so a run's request sequence is reproducible
+static uint64_t next_random(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static int hist_bucket(uint64_t us) {
+    if (us < HIST_EXACT) return (int)us;
+    int k = 63 - __builtin_clzll(us);
+    if (k >= HIST_MAX_SHIFT) return HIST_BUCKETS - 1;
+    int sub = (int)(us >> (k - HIST_SUB_BITS)) - (1 << HIST_SUB_BITS);
+    return HIST_EXACT + (k - 6) * (1 << HIST_SUB_BITS) + sub;
+}
+
+// Highest value that lands in the bucket
+static uint64_t hist_bucket_value(int i) {
+    if (i < HIST_EXACT) return (uint64_t)i;
+    int k = 6 + (i - HIST_EXACT) / (1 << HIST_SUB_BITS);
+    uint64_t sub = (uint64_t)((i - HIST_EXACT) % (1 << HIST_SUB_BITS));
+    return (((1ull << HIST_SUB_BITS) + sub + 1) << (k - HIST_SUB_BITS)) - 1;
+}
+
+static void hist_record(Histogram* h, uint64_t us) {
+    h->counts[hist_bucket(us)]++;
+    h->total++;
+    if (us > h->max_us) h->max_us = us;
+}
+
+static void hist_merge(Histogram* into, const Histogram* from) {
+    for (int i = 0; i < HIST_BUCKETS; i++) into->counts[i] += from->counts[i];
+    into->total += from->total;
+    if (from->max_us > into->max_us) into->max_us = from->max_us;
+}
+
+static uint64_t hist_percentile(const Histogram* h, double p) {
+    if (h->total == 0) return 0;
+    uint64_t rank = (uint64_t)(p * h->total + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t value = hist_bucket_value(i);
+            return value < h->max_us ? value : h->max_us;
+        }
+    }
+    return h->max_us;
+}
+
+// --- HTTP Client ---
+
+static void client_close(Client* c) {
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    c->len = 0;
+}
+
+static int client_connect(Client* c) {
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0) return -1;
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (struct sockaddr*)&g_coordinator, sizeof(g_coordinator)) < 0) {
+        client_close(c);
+        return -1;
+    }
+    c->len = 0;
+    return 0;
+}
+
+static int send_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Reads more into the buffer. Returns bytes read, 0 on EOF, -1 on error or a full buffer.
+static ssize_t client_fill(Client* c) {
+    if (c->len == sizeof(c->buf)) return -1;
+    for (;;) {
+        ssize_t n = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n > 0) c->len += n;
+        return n;
+    }
+}
+
+static void client_consume(Client* c, size_t n) {
+    memmove(c->buf, c->buf + n, c->len - n);
+    c->len -= n;
+}
+
+// Discards `n` bytes of body, reading them as needed
+static int client_skip(Client* c, size_t n) {
+    while (n > 0) {
+        if (c->len == 0 && client_fill(c) <= 0) return -1;
+        size_t take = c->len < n ? c->len : n;
+        client_consume(c, take);
+        n -= take;
+    }
+    return 0;
+}
+
+// Returns the length of the next CRLF-terminated line, including the CRLF
+static ssize_t client_line(Client* c) {
+    for (;;) {
+        char* end = memmem(c->buf, c->len, "\r\n", 2);
+        if (end) return end - c->buf + 2;
+        if (client_fill(c) <= 0) return -1;
+    }
+}
+
+// Reads one response and throws its body away. Returns the status code,
+// or -1 if the connection broke; closes the client if the server will.
+static int client_read_response(Client* c) {
+    char* end;
+    while (!(end = memmem(c->buf, c->len, "\r\n\r\n", 4))) {
+        if (client_fill(c) <= 0) return -1;
+    }
+    size_t head_len = end - c->buf + 4;
+    *end = '\0';
+    int status = c->len > 12 ? atoi(c->buf + 9) : -1;
+    long long content_length = -1;
+    int chunked = 0, close_after = 0;
+    for (char* line = strstr(c->buf, "\r\n"); line; line = strstr(line + 2, "\r\n")) {
+        const char* h = line + 2;
+        if (strncasecmp(h, "Content-Length:", 15) == 0) content_length = atoll(h + 15);
+        else if (strncasecmp(h, "Transfer-Encoding:", 18) == 0 && strcasestr(h, "chunked")) chunked = 1;
+        else if (strncasecmp(h, "Connection:", 11) == 0 && strcasestr(h, "close")) close_after = 1;
+    }
+    client_consume(c, head_len);
+
+    if (chunked) {
+        for (;;) {
+            ssize_t line = client_line(c);
+            if (line < 0) return -1;
+            size_t size = strtoul(c->buf, NULL, 16);
+            client_consume(c, line);
+            if (size == 0) break;
+            if (client_skip(c, size + 2) < 0) return -1; // Data and its CRLF
+        }
+        for (;;) { // Trailers, up to the empty line
+            ssize_t line = client_line(c);
+            if (line < 0) return -1;
+            client_consume(c, line);
+            if (line == 2) break;
+        }
+    } else if (content_length >= 0) {
+        if (client_skip(c, (size_t)content_length) < 0) return -1;
+    } else {
+        while (client_fill(c) > 0) c->len = 0; // Unframed: the body ends at EOF
+        close_after = 1;
+    }
+    if (close_after) client_close(c);
+    return status;
+}
+
+// --- Workload ---
+
+static int build_request(char* out, size_t cap, Op op, uint64_t* rng) {
+    unsigned unit = (unsigned)(next_random(rng) % (uint64_t)g_config.units);
+    int stub_port = g_config.stub_port + (int)(unit % (unsigned)g_config.stub_ports);
+    char body[512];
+    switch (op) {
+        case OP_REGISTER: {
+            int body_len = snprintf(body, sizeof(body), "{\"unit_name\":\"bench-unit-%u\",\"listen_port\":%d}", unit, stub_port);
+            return snprintf(out, cap, "POST /register HTTP/1.1\r\nHost: coordinator\r\nContent-Type: application/json\r\n"
+                            "Content-Length: %d\r\n\r\n%s", body_len, body);
+        }
+        case OP_RESOLVE:
+            return snprintf(out, cap, "GET /resolve?unit=bench-unit-%u HTTP/1.1\r\nHost: coordinator\r\n\r\n", unit);
+        case OP_UNITS:
+            return snprintf(out, cap, "GET /units HTTP/1.1\r\nHost: coordinator\r\n\r\n");
+        case OP_NODES:
+            return snprintf(out, cap, "GET /nodes?target_unit=bench-unit-%u HTTP/1.1\r\nHost: coordinator\r\n\r\n", unit);
+        case OP_SYNC: {
+            int head = snprintf(body, sizeof(body), "{\"target_unit\":\"bench-unit-%u\",\"payload\":\"", unit);
+            size_t body_len = head + (size_t)g_config.sync_bytes + 2;
+            return snprintf(out, cap, "POST /sync HTTP/1.1\r\nHost: coordinator\r\nContent-Type: application/json\r\n"
+                            "Content-Length: %zu\r\n\r\n%s%s\"}", body_len, body, g_sync_payload);
+        }
+        default:
+            return -1;
+    }
+}
+
+static Op pick_op(uint64_t* rng, int total_weight) {
+    int roll = (int)(next_random(rng) % (uint64_t)total_weight);
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (roll < g_config.weights[op]) return (Op)op;
+        roll -= g_config.weights[op];
+    }
+    return OP_REGISTER;
+}
+
+static void* worker_thread(void* arg) {
+    Worker* w = arg;
+    Client* c = malloc(sizeof(Client));
+    size_t request_cap = 1024 + (size_t)g_config.sync_bytes;
+    char* request = malloc(request_cap);
+    if (!c || !request) {
+        fprintf(stderr, "Out of memory in client thread\n");
+        free(c);
+        free(request);
+        return NULL;
+    }
+    c->fd = -1;
+    c->len = 0;
+    uint64_t rng = g_config.seed * 0x9E3779B97F4A7C15ULL + (uint64_t)w->index + 1;
+    int total_weight = 0;
+    for (int op = 0; op < OP_COUNT; op++) total_weight += g_config.weights[op];
+
+    while (!atomic_load(&g_stopping)) {
+        if (c->fd < 0) {
+            if (client_connect(c) < 0) {
+                usleep(1000);
+                continue;
+            }
+            w->stats.reconnects++;
+        }
+        Op op = pick_op(&rng, total_weight);
+        int request_len = build_request(request, request_cap, op, &rng);
+        uint64_t start = monotonic_us();
+        int status = send_all(c->fd, request, request_len) < 0 ? -1 : client_read_response(c);
+        uint64_t elapsed = monotonic_us() - start;
+        if (status < 0) client_close(c);
+        if (!atomic_load_explicit(&g_recording, memory_order_relaxed)) continue;
+        hist_record(&w->stats.latency[op], elapsed);
+        if (status < 200 || status > 299) w->stats.errors[op]++;
+    }
+    client_close(c);
+    free(c);
+    free(request);
+    return NULL;
+}
+
+// Registers every unit up front through /register/batch; returns -1 if the coordinator won't take them
+static int register_units(double* seconds) {
+    uint64_t start = monotonic_us();
+    Client* c = malloc(sizeof(Client));
+    size_t cap = (size_t)REGISTER_BATCH * 64 + 256;
+    char* request = malloc(cap);
+    int result = 0;
+    if (!c || !request) {
+        result = -1;
+        goto done;
+    }
+    c->fd = -1;
+    for (int first = 0; first < g_config.units && result == 0; first += REGISTER_BATCH) {
+        int last = first + REGISTER_BATCH < g_config.units ? first + REGISTER_BATCH : g_config.units;
+        size_t head_room = 160;
+        size_t len = head_room;
+        request[len++] = '[';
+        for (int i = first; i < last; i++) {
+            len += snprintf(request + len, cap - len, "%s{\"unit_name\":\"bench-unit-%d\",\"listen_port\":%d}",
+                            i > first ? "," : "", i, g_config.stub_port + i % g_config.stub_ports);
+        }
+        request[len++] = ']';
+        char head[160];
+        int head_len = snprintf(head, sizeof(head), "POST /register/batch HTTP/1.1\r\nHost: coordinator\r\n"
+                                "Content-Type: application/json\r\nContent-Length: %zu\r\n\r\n", len - head_room);
+        memcpy(request + head_room - head_len, head, head_len);
+        if (c->fd < 0 && client_connect(c) < 0) {
+            result = -1;
+            break;
+        }
+        int status = send_all(c->fd, request + head_room - head_len, len - head_room + head_len) < 0
+                   ? -1 : client_read_response(c);
+        if (status != 200) {
+            fprintf(stderr, "Registration batch at unit %d failed with status %d\n", first, status);
+            result = -1;
+        }
+    }
+    if (c) client_close(c);
+done:
+    free(c);
+    free(request);
+    *seconds = (monotonic_us() - start) / 1e6;
+    return result;
+}
+
+static int wait_for_coordinator(void) {
+    uint64_t deadline = monotonic_us() + (uint64_t)CONNECT_WAIT_MS * 1000;
+    Client probe = { .fd = -1 };
+    while (client_connect(&probe) < 0) {
+        if (monotonic_us() > deadline) return -1;
+        usleep(50 * 1000);
+    }
+    client_close(&probe);
+    return 0;
+}
+
+// --- Report ---
+
+static void print_latency(const Histogram* h, uint64_t errors, double seconds) {
+    printf("{\"requests\":%llu,\"errors\":%llu,\"throughput_rps\":%.1f,"
+           "\"p50_us\":%llu,\"p99_us\":%llu,\"p999_us\":%llu,\"max_us\":%llu}",
+           (unsigned long long)h->total, (unsigned long long)errors, seconds > 0 ? h->total / seconds : 0.0,
+           (unsigned long long)hist_percentile(h, 0.50), (unsigned long long)hist_percentile(h, 0.99),
+           (unsigned long long)hist_percentile(h, 0.999), (unsigned long long)h->max_us);
+}
+
+static void print_report(Worker* workers, double seconds, double setup_seconds) {
+    static Histogram per_op[OP_COUNT], all;
+    uint64_t errors[OP_COUNT] = { 0 }, total_errors = 0, reconnects = 0;
+    for (int i = 0; i < g_config.concurrency; i++) {
+        for (int op = 0; op < OP_COUNT; op++) {
+            hist_merge(&per_op[op], &workers[i].stats.latency[op]);
+            hist_merge(&all, &workers[i].stats.latency[op]);
+            errors[op] += workers[i].stats.errors[op];
+            total_errors += workers[i].stats.errors[op];
+        }
+        reconnects += workers[i].stats.reconnects;
+    }
+
+    printf("{\"coordinator\":\"%s:%d\",\"units\":%d,\"concurrency\":%d,\"duration_s\":%.3f,\"seed\":%llu,",
+           g_config.host, g_config.port, g_config.units, g_config.concurrency, seconds,
+           (unsigned long long)g_config.seed);
+    printf("\"mix\":{");
+    for (int op = 0; op < OP_COUNT; op++) printf("%s\"%s\":%d", op ? "," : "", g_op_names[op], g_config.weights[op]);
+    printf("},\"setup_s\":%.3f,\"connections\":%llu,\"total\":", setup_seconds, (unsigned long long)reconnects);
+    print_latency(&all, total_errors, seconds);
+    printf(",\"routes\":{");
+    int first = 1;
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (g_config.weights[op] == 0) continue;
+        printf("%s\"%s\":", first ? "" : ",", g_op_names[op]);
+        print_latency(&per_op[op], errors[op], seconds);
+        first = 0;
+    }
+    printf("}}\n");
+}
+
+// --- Options ---
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options]\n"
+           "  -a, --coordinator HOST:PORT  Coordinator to load, an IPv4 address (default: 127.0.0.1:%d)\n"
+           "  -s, --stub-port N     First port of exodus-stub-unit (default: %d)\n"
+           "  -n, --stub-ports N    Stub ports units are spread over (default: 1)\n"
+           "  -u, --units N         Units registered before the run, 1 to 1000000 (default: %d)\n"
+           "  -c, --concurrency N   Client threads, one keep-alive connection each (default: %d)\n"
+           "  -d, --duration S      Measured seconds (default: %d)\n"
+           "  -W, --warmup S        Unmeasured seconds before that (default: %d)\n"
+           "  -m, --mix SPEC        Weights, e.g. register=40,resolve=30,units=5,nodes=15,sync=10\n"
+           "  -b, --sync-bytes N    Payload bytes in each /sync body (default: %d)\n"
+           "  -S, --seed N          Seed for the request sequence (default: 1)\n"
+           "  -x, --skip-setup      Don't register units; they are already there\n"
+           "  -h, --help            Show this help\n",
+           prog, DEFAULT_COORDINATOR_PORT, DEFAULT_STUB_PORT, DEFAULT_UNITS, DEFAULT_CONCURRENCY,
+           DEFAULT_DURATION_SECONDS, DEFAULT_WARMUP_SECONDS, DEFAULT_SYNC_BYTES);
+}
+
+static int parse_int(const char* arg, int min, int max) {
+    char* end;
+    errno = 0;
+    long value = strtol(arg, &end, 10);
+    if (errno || end == arg || *end != '\0' || value < min || value > max) return -1;
+    return (int)value;
+}
+
+static int parse_mix(char* spec) {
+    int weights[OP_COUNT] = { 0 };
+    int total = 0;
+    for (char* item = strtok(spec, ","); item; item = strtok(NULL, ",")) {
+        char* eq = strchr(item, '=');
+        if (!eq) return -1;
+        *eq = '\0';
+        int op = 0;
+        while (op < OP_COUNT && strcmp(item, g_op_names[op]) != 0) op++;
+        if (op == OP_COUNT || (weights[op] = parse_int(eq + 1, 0, 1000000)) < 0) return -1;
+        total += weights[op];
+    }
+    if (total == 0) return -1;
+    memcpy(g_config.weights, weights, sizeof(weights));
+    return 0;
+}
+
+static int parse_args(int argc, char** argv) {
+    static const struct option long_opts[] = {
+        { "coordinator", required_argument, NULL, 'a' },
+        { "stub-port",   required_argument, NULL, 's' },
+        { "stub-ports",  required_argument, NULL, 'n' },
+        { "units",       required_argument, NULL, 'u' },
+        { "concurrency", required_argument, NULL, 'c' },
+        { "duration",    required_argument, NULL, 'd' },
+        { "warmup",      required_argument, NULL, 'W' },
+        { "mix",         required_argument, NULL, 'm' },
+        { "sync-bytes",  required_argument, NULL, 'b' },
+        { "seed",        required_argument, NULL, 'S' },
+        { "skip-setup",  no_argument,       NULL, 'x' },
+        { "help",        no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "a:s:n:u:c:d:W:m:b:S:xh", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'a': {
+                char* colon = strrchr(optarg, ':');
+                if (!colon || (size_t)(colon - optarg) >= sizeof(g_config.host) ||
+                    (g_config.port = parse_int(colon + 1, 1, 65535)) < 0) {
+                    fprintf(stderr, "Invalid coordinator address: %s\n", optarg); return -1;
+                }
+                memcpy(g_config.host, optarg, colon - optarg);
+                g_config.host[colon - optarg] = '\0';
+                break;
+            }
+            case 's':
+                if ((g_config.stub_port = parse_int(optarg, 1, 65535)) < 0) {
+                    fprintf(stderr, "Invalid stub port: %s\n", optarg); return -1;
+                }
+                break;
+            case 'n':
+                if ((g_config.stub_ports = parse_int(optarg, 1, 65535)) < 0) {
+                    fprintf(stderr, "Invalid stub port count: %s\n", optarg); return -1;
+                }
+                break;
+            case 'u':
+                if ((g_config.units = parse_int(optarg, 1, 1000000)) < 0) {
+                    fprintf(stderr, "Invalid unit count: %s\n", optarg); return -1;
+                }
+                break;
+            case 'c':
+                if ((g_config.concurrency = parse_int(optarg, 1, 10000)) < 0) {
+                    fprintf(stderr, "Invalid concurrency: %s\n", optarg); return -1;
+                }
+                break;
+            case 'd':
+                if ((g_config.duration_seconds = parse_int(optarg, 1, INT_MAX)) < 0) {
+                    fprintf(stderr, "Invalid duration: %s\n", optarg); return -1;
+                }
+                break;
+            case 'W':
+                if ((g_config.warmup_seconds = parse_int(optarg, 0, INT_MAX)) < 0) {
+                    fprintf(stderr, "Invalid warmup: %s\n", optarg); return -1;
+                }
+                break;
+            case 'm':
+                if (parse_mix(optarg) < 0) {
+                    fprintf(stderr, "Invalid mix (expected name=weight,... over %s, %s, %s, %s, %s)\n",
+                            g_op_names[0], g_op_names[1], g_op_names[2], g_op_names[3], g_op_names[4]);
+                    return -1;
+                }
+                break;
+            case 'b':
+                if ((g_config.sync_bytes = parse_int(optarg, 0, 16 * 1024 * 1024)) < 0) {
+                    fprintf(stderr, "Invalid sync payload size: %s\n", optarg); return -1;
+                }
+                break;
+            case 'S':
+                if (parse_int(optarg, 0, INT_MAX) < 0) {
+                    fprintf(stderr, "Invalid seed: %s\n", optarg); return -1;
+                }
+                g_config.seed = (uint64_t)atoi(optarg);
+                break;
+            case 'x':
+                g_config.skip_setup = 1;
+                break;
+            case 'h':
+                print_usage(argv[0]); exit(0);
+            default:
+                print_usage(argv[0]); return -1;
+        }
+    }
+    if (g_config.stub_port + g_config.stub_ports - 1 > 65535) {
+        fprintf(stderr, "Stub port range runs past 65535\n"); return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (parse_args(argc, argv) < 0) return 1;
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&g_coordinator, 0, sizeof(g_coordinator));
+    g_coordinator.sin_family = AF_INET;
+    g_coordinator.sin_port = htons(g_config.port);
+    if (inet_pton(AF_INET, g_config.host, &g_coordinator.sin_addr) != 1) {
+        fprintf(stderr, "Coordinator host must be an IPv4 address: %s\n", g_config.host);
+        return 1;
+    }
+    g_sync_payload = malloc((size_t)g_config.sync_bytes + 1);
+    Worker* workers = calloc(g_config.concurrency, sizeof(Worker));
+    if (!g_sync_payload || !workers) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    memset(g_sync_payload, 'x', g_config.sync_bytes);
+    g_sync_payload[g_config.sync_bytes] = '\0';
+
+    if (wait_for_coordinator() < 0) {
+        fprintf(stderr, "Coordinator at %s:%d is not accepting connections\n", g_config.host, g_config.port);
+        return 1;
+    }
+    double setup_seconds = 0;
+    if (!g_config.skip_setup) {
+        fprintf(stderr, "Registering %d units...\n", g_config.units);
+        if (register_units(&setup_seconds) < 0) return 1;
+    }
+
+    fprintf(stderr, "Running %d clients for %ds (after %ds warmup)...\n",
+            g_config.concurrency, g_config.duration_seconds, g_config.warmup_seconds);
+    for (int i = 0; i < g_config.concurrency; i++) {
+        workers[i].index = i;
+        if (pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]) != 0) {
+            fprintf(stderr, "Could not start client thread %d\n", i);
+            return 1;
+        }
+    }
+    sleep(g_config.warmup_seconds);
+    uint64_t start = monotonic_us();
+    atomic_store(&g_recording, 1);
+    sleep(g_config.duration_seconds);
+    atomic_store(&g_recording, 0);
+    double seconds = (monotonic_us() - start) / 1e6;
+    atomic_store(&g_stopping, 1);
+    for (int i = 0; i < g_config.concurrency; i++) pthread_join(workers[i].thread, NULL);
+
+    print_report(workers, seconds, setup_seconds);
+    free(workers);
+    free(g_sync_payload);
+    return 0;
+}
@@ -8,20 +8,29 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
 #include <pthread.h>
 #include <errno.h>
 #include <limits.h>
+#include <ctype.h>
 #include <sys/stat.h>
 #include <time.h> 
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <netdb.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <semaphore.h>
+#include <getopt.h>
 
 #include "ctz-json.h" // We only need ctz-json.h, not exodus-common.h
 
@@ -29,354 +38,3558 @@
 #define PATH_MAX 4096
 #endif
 
-#define COORDINATOR_PORT 8080 // Port this server listens on
+#define COORDINATOR_PORT 8080 // Default port this server listens on
 #define UNIT_TIMEOUT_SECONDS 90 // Time before a unit is considered "offline"
 #define MAX_HTTP_BODY_SIZE (50 * 1024 * 1024)
+#define MAX_REGISTER_BATCH 10000 // Entries accepted by one POST /register/batch
+#define MAX_WORKER_THREADS 512 // Keeps the thread count within the registry's reader slots
+#define DEFAULT_QUEUE_DEPTH 1024 // Requests waiting for a worker before new ones are shed
+#define DEFAULT_IDLE_TIMEOUT_SECONDS 30 // Keep-alive connections with no traffic are closed after this
+#define DEFAULT_MAX_REQUESTS_PER_CONN 1000
+#define DEFAULT_OFFLINE_GRACE_SECONDS 900 // How long an offline unit is kept before eviction
+#define DEFAULT_UPSTREAM_MAX_IDLE 8 // Idle pooled connections kept per unit
+#define DEFAULT_UPSTREAM_MAX_CONNS 32 // Open connections per unit, idle or in use
+#define DEFAULT_CONNECT_TIMEOUT_MS 2000 // Includes time spent waiting for a connection slot
+#define DEFAULT_FIRST_BYTE_TIMEOUT_MS 5000 // From sending the request to the first response byte
+#define DEFAULT_UPSTREAM_TIMEOUT_MS 10000 // Whole upstream call
+#define DEFAULT_SYNC_PARALLEL 32 // Upstream calls one fan-out /sync keeps in flight
+#define DEFAULT_NODES_CACHE_TTL_MS 1000 // How long a unit's /nodes_list answer is reused; 0 = never
+#define DEFAULT_LOG_SAMPLE 1 // Keep one in this many per-request debug records
+
+// Log levels, lowest first
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARN 2
+#define LOG_ERROR 3
+#define MAX_SYNC_TARGETS 10000 // Units one fan-out /sync may address
+
+// --- Configuration ---
+
+typedef struct {
+    int port;
+    int worker_count; // 0 = one per online core
+    int queue_depth;
+    int idle_timeout_seconds;
+    int max_requests_per_conn;
+    int offline_grace_seconds;
+    int upstream_max_idle;
+    int upstream_max_conns;
+    int connect_timeout_ms;
+    int first_byte_timeout_ms;
+    int upstream_timeout_ms;
+    int sync_parallel;
+    int nodes_cache_ttl_ms;
+    int log_level; // LOG_DEBUG .. LOG_ERROR
+    int log_sample;
+} CoordinatorConfig;
+
+static CoordinatorConfig g_config = {
+    .port = COORDINATOR_PORT,
+    .worker_count = 0,
+    .queue_depth = DEFAULT_QUEUE_DEPTH,
+    .idle_timeout_seconds = DEFAULT_IDLE_TIMEOUT_SECONDS,
+    .max_requests_per_conn = DEFAULT_MAX_REQUESTS_PER_CONN,
+    .offline_grace_seconds = DEFAULT_OFFLINE_GRACE_SECONDS,
+    .upstream_max_idle = DEFAULT_UPSTREAM_MAX_IDLE,
+    .upstream_max_conns = DEFAULT_UPSTREAM_MAX_CONNS,
+    .connect_timeout_ms = DEFAULT_CONNECT_TIMEOUT_MS,
+    .first_byte_timeout_ms = DEFAULT_FIRST_BYTE_TIMEOUT_MS,
+    .upstream_timeout_ms = DEFAULT_UPSTREAM_TIMEOUT_MS,
+    .sync_parallel = DEFAULT_SYNC_PARALLEL,
+    .nodes_cache_ttl_ms = DEFAULT_NODES_CACHE_TTL_MS,
+    .log_level = LOG_INFO,
+    .log_sample = DEFAULT_LOG_SAMPLE,
+};
 
 // --- Data Structures ---
 
+// A binary socket address (IPv4 or IPv6), as accepted or as connected to
+typedef struct {
+    struct sockaddr_storage sa;
+    socklen_t len;
+} NetAddr;
+
 typedef struct Unit {
     char name[128];
-    char ip_addr[64];
+    char ip_addr[64];  // Text form, for /resolve and logs
     int signal_port;
-    time_t last_seen;
-    struct Unit* next;
+    NetAddr addr;      // Peer address at registration with signal_port set; proxied calls connect to it as is
+    _Atomic(time_t) last_seen; // Heartbeats refresh this in place; address changes publish a new Unit
+    _Atomic int online;        // Cleared by the expiry thread, set again by the next heartbeat
+    struct UnitTimer* timer;   // Expiry timer, shared by every version of the unit
+    uint64_t hash; // Hash of name, kept so probes and rehashes never rehash the string
 } Unit;
 
-static Unit* g_unit_list_head = NULL;
-static pthread_mutex_t g_unit_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+// The registry is split into shards by name hash, each an open-addressing
+// (linear probing) table. Writers serialize on the shard lock; readers take
+// no lock at all. Tables and Unit versions are published with release
+// stores and only freed once every reader that could have seen them has
+// left its epoch (see Epoch Reclamation below).
+#define REGISTRY_SHARD_COUNT 64 // Power of two
+#define REGISTRY_SHARD_INITIAL_CAPACITY 64
+#define REGISTRY_SHARD_BITS 6
+
+typedef struct {
+    size_t capacity; // Power of two; live units plus tombstones kept at most 3/4 full
+    _Atomic(Unit*) slots[];
+} UnitTable;
+
+typedef struct {
+    pthread_mutex_t lock;      // Writers only
+    _Atomic(UnitTable*) table; // NULL until the first registration lands here
+    size_t count;
+    size_t tombstones;
+} __attribute__((aligned(64))) RegistryShard;
+
+static RegistryShard g_registry[REGISTRY_SHARD_COUNT];
+
+// Registry revision: bumped by every unit event (added, address changed,
+// online/offline, evicted), i.e. whenever the /units listing or a unit's
+// address changes. Also numbers the events in the change feed.
+static _Atomic uint64_t g_registry_generation = 1;
 
 static volatile int g_keep_running = 1;
 
-// --- Utility Functions ---
+// --- Logging ---
+
+// Logging never blocks a request and never touches stdio on the calling
+// thread. A record is formatted into a per-thread staging line, then copied
+// into a slot of a bounded ring (the sequence-number scheme of the worker
+// queue, with one consumer). A writer thread drains the ring and writes
+// each batch of lines with one write(2). When the ring is full the record
+// is dropped and counted; the writer reports the count once it catches up.
+// Records below LOG_COMPILE_LEVEL are compiled out; records below
+// --log-level cost one compare. Per-request records (accepted connections,
+// plain heartbeats) are debug records that --log-sample thins out. Before
+// the writer starts, and after it stops, records are written directly.
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_DEBUG // Build with -DLOG_COMPILE_LEVEL=1 to drop debug records entirely
+#endif
+
+#define LOG_RING_SIZE 4096 // Records; power of two
+#define LOG_LINE_MAX 256   // Longer records are cut short
+#define LOG_BATCH_SIZE (64 * 1024)
+
+#define log_at(level, ...) do { \
+    if ((level) >= LOG_COMPILE_LEVEL && (level) >= g_config.log_level) log_write(__VA_ARGS__); \
+} while (0)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+#define log_msg(...) log_at(LOG_INFO, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_WARN, __VA_ARGS__)
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+// A debug record logged on every request: only one in --log-sample is kept
+#define log_sampled(...) do { \
+    if (LOG_DEBUG >= LOG_COMPILE_LEVEL && LOG_DEBUG >= g_config.log_level && log_sample()) log_write(__VA_ARGS__); \
+} while (0)
+
+typedef struct {
+    _Atomic size_t seq;
+    size_t len;
+    char line[LOG_LINE_MAX];
+} LogSlot;
+
+static LogSlot g_log_slots[LOG_RING_SIZE];
+static _Alignas(64) _Atomic size_t g_log_enqueue_pos;
+static _Alignas(64) size_t g_log_dequeue_pos; // Writer thread only
+static _Atomic size_t g_log_dropped;
+static _Atomic int g_log_writer_waiting; // Set while the writer sleeps on g_log_wake
+static sem_t g_log_wake;
+static pthread_t g_log_writer;
+static _Atomic int g_log_running = 0; // Records go through the ring only while set
+static _Atomic int g_log_stopping = 0;
+static __thread char t_log_line[LOG_LINE_MAX];
+static __thread unsigned t_log_sample_tick;
+
+static int log_sample(void) {
+    return t_log_sample_tick++ % (unsigned)g_config.log_sample == 0;
+}
+
+static void write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+// Returns -1 without blocking when the ring is full
+static int log_ring_push(const char* line, size_t len) {
+    size_t pos = atomic_load_explicit(&g_log_enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        LogSlot* slot = &g_log_slots[pos & (LOG_RING_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&g_log_enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                memcpy(slot->line, line, len);
+                slot->len = len;
+                atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1; // Full
+        } else {
+            pos = atomic_load_explicit(&g_log_enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
 
-void log_msg(const char* format, ...) {
+// Writer side: the oldest published record, or NULL if there is none yet
+static LogSlot* log_ring_peek(void) {
+    LogSlot* slot = &g_log_slots[g_log_dequeue_pos & (LOG_RING_SIZE - 1)];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    return seq == g_log_dequeue_pos + 1 ? slot : NULL;
+}
+
+static void log_ring_release(LogSlot* slot) {
+    atomic_store_explicit(&slot->seq, g_log_dequeue_pos + LOG_RING_SIZE, memory_order_release);
+    g_log_dequeue_pos++;
+}
+
+static void log_write(const char* format, ...) {
     va_list args;
     va_start(args, format);
-    printf("[Coordinator] ");
-    vprintf(format, args);
-    printf("\n");
-    fflush(stdout);
+    int n = snprintf(t_log_line, LOG_LINE_MAX, "[Coordinator] ");
+    int m = vsnprintf(t_log_line + n, LOG_LINE_MAX - n, format, args);
     va_end(args);
+    size_t len = m < 0 ? (size_t)n : (size_t)n + m;
+    if (len > LOG_LINE_MAX - 2) len = LOG_LINE_MAX - 2;
+    t_log_line[len++] = '\n';
+
+    if (!atomic_load_explicit(&g_log_running, memory_order_acquire)) {
+        write_all(STDOUT_FILENO, t_log_line, len);
+        return;
+    }
+    if (log_ring_push(t_log_line, len) < 0) {
+        atomic_fetch_add_explicit(&g_log_dropped, 1, memory_order_relaxed);
+        return;
+    }
+    // Pairs with the writer's store to g_log_writer_waiting before it looks at the ring again
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&g_log_writer_waiting, memory_order_relaxed) &&
+        atomic_exchange(&g_log_writer_waiting, 0)) {
+        sem_post(&g_log_wake);
+    }
+}
+
+static void* log_writer_thread(void* arg) {
+    (void)arg;
+    static char batch[LOG_BATCH_SIZE];
+    for (;;) {
+        size_t len = 0;
+        LogSlot* slot;
+        while ((slot = log_ring_peek()) && len + slot->len <= sizeof(batch)) {
+            memcpy(batch + len, slot->line, slot->len);
+            len += slot->len;
+            log_ring_release(slot);
+        }
+        size_t dropped = atomic_exchange_explicit(&g_log_dropped, 0, memory_order_relaxed);
+        if (dropped > 0 && len + LOG_LINE_MAX <= sizeof(batch)) {
+            len += snprintf(batch + len, LOG_LINE_MAX, "[Coordinator] Log ring full: dropped %zu records\n", dropped);
+        } else if (dropped > 0) {
+            atomic_fetch_add_explicit(&g_log_dropped, dropped, memory_order_relaxed); // Next batch
+        }
+        if (len > 0) {
+            write_all(STDOUT_FILENO, batch, len);
+            continue;
+        }
+        if (g_log_stopping) break;
+        atomic_store(&g_log_writer_waiting, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (log_ring_peek() || g_log_stopping) {
+            atomic_store(&g_log_writer_waiting, 0);
+            continue;
+        }
+        while (sem_wait(&g_log_wake) != 0 && errno == EINTR) {}
+    }
+    return NULL;
+}
+
+// Flushes what is queued and goes back to writing records directly
+static void stop_logger(void) {
+    if (!atomic_load(&g_log_running)) return;
+    g_log_stopping = 1;
+    sem_post(&g_log_wake);
+    pthread_join(g_log_writer, NULL);
+    atomic_store(&g_log_running, 0);
+    for (LogSlot* slot; (slot = log_ring_peek()); log_ring_release(slot)) {
+        write_all(STDOUT_FILENO, slot->line, slot->len); // Raced in behind the writer's last batch
+    }
+    sem_destroy(&g_log_wake);
+}
+
+// Stays on direct writes if the writer can't be started. Stopped at exit,
+// so records logged just before any return from main still get out.
+static void start_logger(void) {
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) atomic_init(&g_log_slots[i].seq, i);
+    if (sem_init(&g_log_wake, 0, 0) != 0) return;
+    if (pthread_create(&g_log_writer, NULL, log_writer_thread, NULL) != 0) {
+        sem_destroy(&g_log_wake);
+        return;
+    }
+    atomic_store(&g_log_running, 1);
+    atexit(stop_logger);
 }
 
+// --- Utility Functions ---
+
 void int_handler(int dummy) {
     (void)dummy;
     g_keep_running = 0;
 }
 
-// Simple blocking HTTP request function
-int send_http_request(const char* host, int port, const char* request, char* response_buf, size_t response_size) {
-    struct hostent* server = gethostbyname(host);
-    if (server == NULL) {
-        log_msg("HTTP Client Error: Could not resolve host: %s", host);
-        return -1;
+// Takes an accepted peer address, folding IPv4-mapped IPv6 (from the
+// dual-stack listener) back to plain IPv4 so a unit has one identity
+static void net_addr_set(NetAddr* out, const struct sockaddr* sa, socklen_t len) {
+    memset(out, 0, sizeof(*out));
+    const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)sa;
+    if (sa->sa_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&in6->sin6_addr)) {
+        struct sockaddr_in* in = (struct sockaddr_in*)&out->sa;
+        in->sin_family = AF_INET;
+        in->sin_port = in6->sin6_port;
+        memcpy(&in->sin_addr, &in6->sin6_addr.s6_addr[12], 4);
+        out->len = sizeof(struct sockaddr_in);
+        return;
     }
+    if (len > sizeof(out->sa)) len = sizeof(out->sa);
+    memcpy(&out->sa, sa, len);
+    out->len = len;
+}
 
-    int sock_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock_fd < 0) {
-        log_msg("HTTP Client Error: Could not create socket");
-        return -1;
+static void net_addr_set_port(NetAddr* a, int port) {
+    if (a->sa.ss_family == AF_INET6) ((struct sockaddr_in6*)&a->sa)->sin6_port = htons(port);
+    else ((struct sockaddr_in*)&a->sa)->sin_port = htons(port);
+}
+
+static int net_addr_port(const NetAddr* a) {
+    if (a->sa.ss_family == AF_INET6) return ntohs(((const struct sockaddr_in6*)&a->sa)->sin6_port);
+    return ntohs(((const struct sockaddr_in*)&a->sa)->sin_port);
+}
+
+static void net_addr_ip(const NetAddr* a, char* buf, size_t size) {
+    const void* bin = a->sa.ss_family == AF_INET6 ? (const void*)&((const struct sockaddr_in6*)&a->sa)->sin6_addr
+                                                  : (const void*)&((const struct sockaddr_in*)&a->sa)->sin_addr;
+    if (!inet_ntop(a->sa.ss_family, bin, buf, size)) snprintf(buf, size, "?");
+}
+
+// "ip:port", with IPv6 addresses bracketed as in a URL or Host header
+static void net_addr_host_port(const NetAddr* a, char* buf, size_t size) {
+    char ip[INET6_ADDRSTRLEN];
+    net_addr_ip(a, ip, sizeof(ip));
+    snprintf(buf, size, a->sa.ss_family == AF_INET6 ? "[%s]:%d" : "%s:%d", ip, net_addr_port(a));
+}
+
+static int net_addr_equal(const NetAddr* a, const NetAddr* b) {
+    if (a->sa.ss_family != b->sa.ss_family) return 0;
+    if (a->sa.ss_family == AF_INET6) {
+        const struct sockaddr_in6* x = (const struct sockaddr_in6*)&a->sa;
+        const struct sockaddr_in6* y = (const struct sockaddr_in6*)&b->sa;
+        return x->sin6_port == y->sin6_port && x->sin6_scope_id == y->sin6_scope_id &&
+               memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr)) == 0;
     }
+    const struct sockaddr_in* x = (const struct sockaddr_in*)&a->sa;
+    const struct sockaddr_in* y = (const struct sockaddr_in*)&b->sa;
+    return x->sin_port == y->sin_port && x->sin_addr.s_addr == y->sin_addr.s_addr;
+}
 
-    struct sockaddr_in serv_addr;
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(port);
-    memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-    if (connect(sock_fd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
-        log_msg("HTTP Client Error: Could not connect to %s:%d", host, port);
-        close(sock_fd);
-        return -1;
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const char* find_header(const char* headers, const char* name) {
+    size_t name_len = strlen(name);
+    const char* line = strstr(headers, "\r\n");
+    while (line && line[2] != '\r' && line[2] != '\0') {
+        line += 2;
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            const char* value = line + name_len + 1;
+            while (*value == ' ' || *value == '\t') value++;
+            return value;
+        }
+        line = strstr(line, "\r\n");
     }
+    return NULL;
+}
 
-    if (write(sock_fd, request, strlen(request)) < 0) {
-        log_msg("HTTP Client Error: Failed to write to socket");
-        close(sock_fd);
-        return -1;
+// Returns the value of `name` in the path's query string (running up to the next '&'), or NULL
+static const char* query_param(const char* path, const char* name) {
+    size_t len = strlen(name);
+    for (const char* q = strchr(path, '?'); q; q = strchr(q, '&')) {
+        q++;
+        if (strncmp(q, name, len) == 0 && q[len] == '=') return q + len + 1;
+    }
+    return NULL;
+}
+
+// --- Epoch Reclamation ---
+
+// Readers publish the global epoch they entered in a per-thread slot and
+// clear it on the way out: a plain store and a fence, no lock or RMW.
+// Writers retire unlinked memory tagged with the epoch current at unlink
+// time, then free it once no reader is still inside that epoch or an
+// earlier one.
+#define EPOCH_MAX_THREADS 1024
+#define EPOCH_RECLAIM_BATCH 64 // Retires between scans of the retired list
+
+typedef struct {
+    _Atomic uint64_t epoch; // 0 = not reading
+} __attribute__((aligned(64))) EpochSlot;
+
+typedef struct RetiredNode {
+    void* ptr;
+    uint64_t epoch;
+    struct RetiredNode* next;
+} RetiredNode;
+
+static EpochSlot g_epoch_slots[EPOCH_MAX_THREADS];
+static _Atomic int g_epoch_slot_count = 0;
+static _Atomic uint64_t g_global_epoch = 1;
+static __thread int t_epoch_slot = -1;
+
+static pthread_mutex_t g_retire_lock = PTHREAD_MUTEX_INITIALIZER;
+static RetiredNode* g_retired = NULL;
+static size_t g_retired_count = 0;
+static size_t g_reclaim_at = EPOCH_RECLAIM_BATCH; // Scan once the list is this long
+
+static void epoch_enter(void) {
+    if (t_epoch_slot < 0) {
+        // First read on this thread; thread count is bounded by the worker cap
+        t_epoch_slot = atomic_fetch_add(&g_epoch_slot_count, 1);
+        if (t_epoch_slot >= EPOCH_MAX_THREADS) abort();
     }
+    uint64_t epoch = atomic_load_explicit(&g_global_epoch, memory_order_acquire);
+    atomic_store_explicit(&g_epoch_slots[t_epoch_slot].epoch, epoch, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst); // Publish the slot before reading shared pointers
+}
 
-    size_t total_read = 0;
-    ssize_t n;
-    while (total_read < response_size - 1) {
-        // Read into the buffer *after* the data we already have
-        n = read(sock_fd, response_buf + total_read, (response_size - 1) - total_read);
-        
-        if (n < 0) {
-            // A real read error
-            log_msg("HTTP Client Error: Failed to read response: %s", strerror(errno));
-            close(sock_fd);
-            return -1;
-        }
-        
-        if (n == 0) {
-            // End of file (connection closed by server), this is the normal exit
-            break;
+static void epoch_exit(void) {
+    atomic_store_explicit(&g_epoch_slots[t_epoch_slot].epoch, 0, memory_order_release);
+}
+
+// Oldest epoch any reader may still be inside
+static uint64_t epoch_min_active(void) {
+    uint64_t min = atomic_load_explicit(&g_global_epoch, memory_order_acquire);
+    int count = atomic_load_explicit(&g_epoch_slot_count, memory_order_acquire);
+    if (count > EPOCH_MAX_THREADS) count = EPOCH_MAX_THREADS;
+    for (int i = 0; i < count; i++) {
+        uint64_t e = atomic_load_explicit(&g_epoch_slots[i].epoch, memory_order_acquire);
+        if (e && e < min) min = e;
+    }
+    return min;
+}
+
+// Queues memory that was just unlinked from shared view. Every
+// EPOCH_RECLAIM_BATCH retires the list is scanned once and whatever is
+// safe is freed after the lock is dropped, so a retire on the reactor
+// thread is O(1) amortized however much churn the registry sees.
+static void epoch_retire(void* ptr) {
+    RetiredNode* node = malloc(sizeof(RetiredNode));
+    uint64_t tag = atomic_fetch_add_explicit(&g_global_epoch, 1, memory_order_seq_cst);
+    RetiredNode* freeable = NULL;
+
+    pthread_mutex_lock(&g_retire_lock);
+    if (node) {
+        node->ptr = ptr;
+        node->epoch = tag;
+        node->next = g_retired;
+        g_retired = node;
+        g_retired_count++;
+    }
+    if (g_retired_count >= g_reclaim_at) {
+        atomic_thread_fence(memory_order_seq_cst);
+        uint64_t safe_below = epoch_min_active();
+        RetiredNode** link = &g_retired;
+        while (*link) {
+            RetiredNode* r = *link;
+            if (r->epoch < safe_below) {
+                *link = r->next;
+                r->next = freeable;
+                freeable = r;
+                g_retired_count--;
+            } else {
+                link = &r->next;
+            }
         }
-        
-        total_read += n;
+        // Whatever a slow reader still pins waits for another full batch
+        g_reclaim_at = g_retired_count + EPOCH_RECLAIM_BATCH;
     }
-    
-    response_buf[total_read] = '\0'; // Null-terminate the full response
-    
-    if (total_read == response_size - 1) {
-         log_msg("HTTP Client Warning: Response buffer may be full. Response might be truncated.");
+    pthread_mutex_unlock(&g_retire_lock);
+
+    while (freeable) {
+        RetiredNode* next = freeable->next;
+        free(freeable->ptr);
+        free(freeable);
+        freeable = next;
+    }
+    if (!node) {
+        // Can't defer it; leaking beats a use-after-free under a reader
+        log_error("Error: out of memory retiring registry memory");
     }
+}
 
-    close(sock_fd);
-    
-    if (strstr(response_buf, "HTTP/1.1 200 OK") == NULL) {
-        log_msg("HTTP Client Error: Target Unit returned non-200 status.");
-        return -1;
+static void epoch_free_all(void) {
+    while (g_retired) {
+        RetiredNode* next = g_retired->next;
+        free(g_retired->ptr);
+        free(g_retired);
+        g_retired = next;
     }
-    
-    return 0; // Success
+    g_retired_count = 0;
 }
 
-// Finds a unit, updates it, or creates it
-void register_unit(const char* name, const char* ip, int port) {
-    pthread_mutex_lock(&g_unit_list_mutex);
-    
-    Unit* unit = g_unit_list_head;
-    while (unit) {
-        if (strcmp(unit->name, name) == 0) {
-            // Found it, update info
-            strncpy(unit->ip_addr, ip, sizeof(unit->ip_addr) - 1);
-            unit->signal_port = port;
-            unit->last_seen = time(NULL);
-            log_msg("Unit re-registered: %s at %s:%d", name, ip, port);
-            pthread_mutex_unlock(&g_unit_list_mutex);
-            return;
+// --- Unit Registry ---
+
+// Marks a slot whose unit was evicted: probes continue past it, inserts may reuse it
+#define UNIT_TOMBSTONE ((Unit*)1)
+
+// FNV-1a over the (already truncated) unit name
+static uint64_t unit_name_hash(const char* name) {
+    uint64_t h = 14695981039346656037ULL;
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Names are stored truncated to the Unit field, so hash and compare the same prefix
+static uint64_t unit_key(const char* name, char key[128]) {
+    strncpy(key, name, 127);
+    key[127] = '\0';
+    return unit_name_hash(key);
+}
+
+static RegistryShard* registry_shard_for(uint64_t hash) {
+    return &g_registry[hash & (REGISTRY_SHARD_COUNT - 1)];
+}
+
+static void registry_init(void) {
+    for (int i = 0; i < REGISTRY_SHARD_COUNT; i++) {
+        pthread_mutex_init(&g_registry[i].lock, NULL);
+        atomic_init(&g_registry[i].table, NULL);
+        g_registry[i].count = 0;
+        g_registry[i].tombstones = 0;
+    }
+}
+
+// Reader-side probe, safe inside an epoch without the shard lock
+static Unit* table_lookup(UnitTable* table, const char* key, uint64_t hash) {
+    size_t mask = table->capacity - 1;
+    size_t i = (hash >> REGISTRY_SHARD_BITS) & mask;
+    for (;;) {
+        Unit* unit = atomic_load_explicit(&table->slots[i], memory_order_acquire);
+        if (!unit) return NULL;
+        if (unit != UNIT_TOMBSTONE && unit->hash == hash && strcmp(unit->name, key) == 0) return unit;
+        i = (i + 1) & mask;
+    }
+}
+
+// Writer-side probe: returns the slot holding the unit, or else the slot a
+// new unit should take (the first tombstone passed, or the terminating
+// empty slot). Caller holds the shard lock.
+static _Atomic(Unit*)* table_slot_for(UnitTable* table, const char* key, uint64_t hash) {
+    size_t mask = table->capacity - 1;
+    size_t i = (hash >> REGISTRY_SHARD_BITS) & mask;
+    _Atomic(Unit*)* reusable = NULL;
+    for (;;) {
+        Unit* unit = atomic_load_explicit(&table->slots[i], memory_order_relaxed);
+        if (!unit) return reusable ? reusable : &table->slots[i];
+        if (unit == UNIT_TOMBSTONE) {
+            if (!reusable) reusable = &table->slots[i];
+        } else if (unit->hash == hash && strcmp(unit->name, key) == 0) {
+            return &table->slots[i];
         }
-        unit = unit->next;
+        i = (i + 1) & mask;
     }
-    
-    // Not found, create new one
-    Unit* new_unit = malloc(sizeof(Unit));
-    if (new_unit) {
-        strncpy(new_unit->name, name, sizeof(new_unit->name) - 1);
-        strncpy(new_unit->ip_addr, ip, sizeof(new_unit->ip_addr) - 1);
-        new_unit->signal_port = port;
-        new_unit->last_seen = time(NULL);
-        new_unit->next = g_unit_list_head;
-        g_unit_list_head = new_unit;
-        log_msg("New unit registered: %s at %s:%d", name, ip, port);
+}
+
+// Copies the live units into a fresh table (dropping tombstones) and
+// publishes it. Caller holds the shard lock.
+static int shard_rebuild(RegistryShard* shard, size_t new_capacity) {
+    UnitTable* old = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    UnitTable* fresh = calloc(1, sizeof(UnitTable) + new_capacity * sizeof(_Atomic(Unit*)));
+    if (!fresh) return -1;
+    fresh->capacity = new_capacity;
+    for (size_t i = 0; old && i < old->capacity; i++) {
+        Unit* unit = atomic_load_explicit(&old->slots[i], memory_order_relaxed);
+        if (!unit || unit == UNIT_TOMBSTONE) continue;
+        size_t j = (unit->hash >> REGISTRY_SHARD_BITS) & (new_capacity - 1);
+        while (atomic_load_explicit(&fresh->slots[j], memory_order_relaxed)) j = (j + 1) & (new_capacity - 1);
+        atomic_store_explicit(&fresh->slots[j], unit, memory_order_relaxed);
     }
-    
-    pthread_mutex_unlock(&g_unit_list_mutex);
+    atomic_store_explicit(&shard->table, fresh, memory_order_release);
+    shard->tombstones = 0;
+    if (old) epoch_retire(old);
+    return 0;
+}
+
+// Makes room for one more unit, rebuilding in place when tombstones rather than live units fill the table
+static int shard_reserve(RegistryShard* shard) {
+    UnitTable* table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    if (!table) return shard_rebuild(shard, REGISTRY_SHARD_INITIAL_CAPACITY);
+    if ((shard->count + shard->tombstones + 1) * 4 <= table->capacity * 3) return 0;
+    size_t capacity = table->capacity;
+    if ((shard->count + 1) * 2 > capacity) capacity *= 2;
+    return shard_rebuild(shard, capacity);
+}
+
+typedef enum {
+    UNIT_EVENT_ADDED,
+    UNIT_EVENT_UPDATED, // Re-registered from a new address
+    UNIT_EVENT_ONLINE,
+    UNIT_EVENT_OFFLINE,
+    UNIT_EVENT_EVICTED
+} UnitEvent;
+
+static struct UnitTimer* create_unit_timer(const char* name, uint64_t hash);
+static void request_expiry_check(struct UnitTimer* timer);
+static void emit_unit_event(UnitEvent event, const char* name);
+
+typedef enum {
+    REGISTER_FAILED,
+    REGISTER_ADDED,
+    REGISTER_MOVED,    // Known unit at a new address
+    REGISTER_REFRESHED // Plain heartbeat
+} RegisterResult;
+
+// One registration, prepared outside the shard lock, applied under it, and
+// finished (events, logs, retiring the replaced version) after it is dropped
+typedef struct {
+    char key[128];
+    uint64_t hash;
+    NetAddr addr;
+    int port;
+    RegisterResult result;
+    const char* error; // Set when result is REGISTER_FAILED
+    int came_online;   // Was offline (or new) before this registration
+    Unit* replaced;    // Old version to retire once unlocked
+} Registration;
+
+// `peer` is the registering connection's address; the unit is reached at that address on `port`
+static void registration_prepare(Registration* r, const char* name, const NetAddr* peer, int port) {
+    r->hash = unit_key(name, r->key);
+    r->addr = *peer;
+    net_addr_set_port(&r->addr, port);
+    r->port = port;
+    r->result = REGISTER_FAILED;
+    r->error = NULL;
+    r->came_online = 0;
+    r->replaced = NULL;
+}
+
+// Finds the unit, updates it, or creates it. Caller holds the shard lock.
+static void registration_apply(RegistryShard* shard, Registration* r, time_t now) {
+    if (shard_reserve(shard) < 0) {
+        r->error = "registry full";
+        return;
+    }
+
+    UnitTable* table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    _Atomic(Unit*)* slot = table_slot_for(table, r->key, r->hash);
+    Unit* unit = atomic_load_explicit(slot, memory_order_relaxed);
+    if (unit == UNIT_TOMBSTONE) unit = NULL;
+
+    if (unit && net_addr_equal(&unit->addr, &r->addr)) {
+        // Plain heartbeat: refresh in place, readers never see a torn address
+        atomic_store_explicit(&unit->last_seen, now, memory_order_relaxed);
+        r->came_online = !atomic_exchange_explicit(&unit->online, 1, memory_order_relaxed);
+        if (r->came_online) request_expiry_check(unit->timer); // Its timer is parked on the eviction deadline
+        r->result = REGISTER_REFRESHED;
+        return;
+    }
+
+    // New unit, or its address changed: publish a fresh version (copy-on-write)
+    Unit* new_unit = calloc(1, sizeof(Unit));
+    struct UnitTimer* timer = unit ? unit->timer : create_unit_timer(r->key, r->hash);
+    if (!new_unit || !timer) {
+        free(new_unit);
+        if (!unit) free(timer); // Not armed yet; a moved unit keeps its own
+        r->error = "out of memory";
+        return;
+    }
+    memcpy(new_unit->name, r->key, sizeof(new_unit->name));
+    net_addr_ip(&r->addr, new_unit->ip_addr, sizeof(new_unit->ip_addr));
+    new_unit->signal_port = r->port;
+    new_unit->addr = r->addr;
+    atomic_init(&new_unit->last_seen, now);
+    atomic_init(&new_unit->online, 1);
+    new_unit->hash = r->hash;
+    new_unit->timer = timer;
+    if (!unit && atomic_load_explicit(slot, memory_order_relaxed) == UNIT_TOMBSTONE) shard->tombstones--;
+    atomic_store_explicit(slot, new_unit, memory_order_release);
+    if (!unit) shard->count++;
+    r->came_online = unit ? !atomic_load_explicit(&unit->online, memory_order_relaxed) : 1;
+    if (r->came_online) request_expiry_check(timer); // Arms a new unit, or wakes a parked one
+    r->replaced = unit;
+    r->result = unit ? REGISTER_MOVED : REGISTER_ADDED;
+}
+
+// Plain heartbeats are only logged if `log_refresh` is set
+static void registration_finish(Registration* r, int log_refresh) {
+    char where[INET6_ADDRSTRLEN + 8];
+    net_addr_host_port(&r->addr, where, sizeof(where));
+    if (r->result == REGISTER_FAILED) {
+        log_error("Error: %s, dropping registration for %s", r->error, r->key);
+        return;
+    }
+    if (r->replaced) epoch_retire(r->replaced);
+    if (r->result == REGISTER_ADDED) {
+        emit_unit_event(UNIT_EVENT_ADDED, r->key);
+        log_msg("New unit registered: %s at %s", r->key, where);
+        return;
+    }
+    if (r->result == REGISTER_MOVED) emit_unit_event(UNIT_EVENT_UPDATED, r->key);
+    if (r->came_online) emit_unit_event(UNIT_EVENT_ONLINE, r->key);
+    if (r->result == REGISTER_MOVED || r->came_online) {
+        log_msg("Unit re-registered: %s at %s", r->key, where);
+    } else if (log_refresh) {
+        log_sampled("Unit re-registered: %s at %s", r->key, where);
+    }
+}
+
+// Finds a unit, updates it, or creates it. `peer` is the registering
+// connection's address; the unit is reached at that address on `port`.
+int register_unit(const char* name, const NetAddr* peer, int port) {
+    Registration r;
+    registration_prepare(&r, name, peer, port);
+    RegistryShard* shard = registry_shard_for(r.hash);
+    pthread_mutex_lock(&shard->lock);
+    registration_apply(shard, &r, time(NULL));
+    pthread_mutex_unlock(&shard->lock);
+    registration_finish(&r, 1);
+    return r.result == REGISTER_FAILED ? -1 : 0;
+}
+
+// Applies a batch in one pass: entries are grouped by shard (keeping their
+// order within a shard, so a repeated name ends up as its last entry says)
+// and each shard's lock is taken once for all of its entries.
+static int register_units(Registration* regs, size_t count) {
+    size_t* order = malloc(count * sizeof(size_t));
+    if (!order) return -1;
+    size_t start[REGISTRY_SHARD_COUNT + 1] = { 0 };
+    for (size_t i = 0; i < count; i++) start[(regs[i].hash & (REGISTRY_SHARD_COUNT - 1)) + 1]++;
+    for (int s = 0; s < REGISTRY_SHARD_COUNT; s++) start[s + 1] += start[s];
+    size_t fill[REGISTRY_SHARD_COUNT];
+    memcpy(fill, start, sizeof(fill));
+    for (size_t i = 0; i < count; i++) order[fill[regs[i].hash & (REGISTRY_SHARD_COUNT - 1)]++] = i;
+
+    time_t now = time(NULL);
+    for (int s = 0; s < REGISTRY_SHARD_COUNT; s++) {
+        if (start[s] == start[s + 1]) continue;
+        RegistryShard* shard = &g_registry[s];
+        pthread_mutex_lock(&shard->lock);
+        for (size_t k = start[s]; k < start[s + 1]; k++) registration_apply(shard, &regs[order[k]], now);
+        pthread_mutex_unlock(&shard->lock);
+    }
+    free(order);
+    for (size_t i = 0; i < count; i++) registration_finish(&regs[i], 0);
+    return 0;
 }
 
-// Finds a unit, returns 0 and fills buffers if successful
-int find_unit(const char* name, char* ip_buf, size_t ip_size, int* port_out) {
+// Finds a unit, returns 0 and fills buffers if successful. Lock-free.
+// addr_out (optional) receives the address to connect to.
+int find_unit(const char* name, char* ip_buf, size_t ip_size, int* port_out, NetAddr* addr_out) {
+    char key[128];
+    uint64_t hash = unit_key(name, key);
+    RegistryShard* shard = registry_shard_for(hash);
     int found = 0;
-    pthread_mutex_lock(&g_unit_list_mutex);
-    
-    Unit* unit = g_unit_list_head;
-    while (unit) {
-        if (strcmp(unit->name, name) == 0) {
-            if (time(NULL) < unit->last_seen + UNIT_TIMEOUT_SECONDS) {
-                // Found and it's online
-                strncpy(ip_buf, unit->ip_addr, ip_size - 1);
-                *port_out = unit->signal_port;
-                found = 1;
+
+    epoch_enter();
+    UnitTable* table = atomic_load_explicit(&shard->table, memory_order_acquire);
+    Unit* unit = table ? table_lookup(table, key, hash) : NULL;
+    if (unit && atomic_load_explicit(&unit->online, memory_order_relaxed)) {
+        // Found and it's online
+        strncpy(ip_buf, unit->ip_addr, ip_size - 1);
+        ip_buf[ip_size - 1] = '\0';
+        *port_out = unit->signal_port;
+        if (addr_out) *addr_out = unit->addr;
+        found = 1;
+    }
+    epoch_exit();
+    return found ? 0 : -1;
+}
+
+// Reads a unit's heartbeat time; returns 0 if the unit is no longer registered
+static time_t unit_last_seen(const char* key, uint64_t hash) {
+    time_t last_seen = 0;
+    epoch_enter();
+    UnitTable* table = atomic_load_explicit(&registry_shard_for(hash)->table, memory_order_acquire);
+    Unit* unit = table ? table_lookup(table, key, hash) : NULL;
+    if (unit) last_seen = atomic_load_explicit(&unit->last_seen, memory_order_relaxed);
+    epoch_exit();
+    return last_seen;
+}
+
+// Flips a unit to offline unless a heartbeat arrived since the caller looked
+static int registry_mark_offline(const char* key, uint64_t hash, time_t stale_before) {
+    RegistryShard* shard = registry_shard_for(hash);
+    int flipped = 0;
+    pthread_mutex_lock(&shard->lock);
+    UnitTable* table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    Unit* unit = table ? table_lookup(table, key, hash) : NULL;
+    if (unit && atomic_load_explicit(&unit->last_seen, memory_order_relaxed) < stale_before) {
+        flipped = atomic_exchange_explicit(&unit->online, 0, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return flipped;
+}
+
+// Removes a unit that is still stale; re-checked under the shard lock so a
+// heartbeat racing the eviction always wins
+static int registry_evict(const char* key, uint64_t hash, time_t stale_before) {
+    RegistryShard* shard = registry_shard_for(hash);
+    Unit* victim = NULL;
+    pthread_mutex_lock(&shard->lock);
+    UnitTable* table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+    if (table) {
+        _Atomic(Unit*)* slot = table_slot_for(table, key, hash);
+        Unit* unit = atomic_load_explicit(slot, memory_order_relaxed);
+        if (unit && unit != UNIT_TOMBSTONE &&
+            atomic_load_explicit(&unit->last_seen, memory_order_relaxed) < stale_before) {
+            atomic_store_explicit(slot, UNIT_TOMBSTONE, memory_order_release);
+            shard->count--;
+            shard->tombstones++;
+            victim = unit;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    if (victim) epoch_retire(victim);
+    return victim != NULL;
+}
+
+// Calls fn for every unit without taking any lock. Each shard is walked on
+// the table snapshot current when the walk reaches it; the Unit pointers
+// stay valid until fn returns, but must not be kept past it.
+static void registry_for_each(void (*fn)(const Unit* unit, void* ctx), void* ctx) {
+    epoch_enter();
+    for (int i = 0; i < REGISTRY_SHARD_COUNT; i++) {
+        UnitTable* table = atomic_load_explicit(&g_registry[i].table, memory_order_acquire);
+        for (size_t j = 0; table && j < table->capacity; j++) {
+            Unit* unit = atomic_load_explicit(&table->slots[j], memory_order_acquire);
+            if (unit && unit != UNIT_TOMBSTONE) fn(unit, ctx);
+        }
+    }
+    epoch_exit();
+}
+
+// Only called once every worker has stopped
+static void registry_free(void) {
+    for (int i = 0; i < REGISTRY_SHARD_COUNT; i++) {
+        RegistryShard* shard = &g_registry[i];
+        UnitTable* table = atomic_load_explicit(&shard->table, memory_order_relaxed);
+        for (size_t j = 0; table && j < table->capacity; j++) {
+            Unit* unit = atomic_load_explicit(&table->slots[j], memory_order_relaxed);
+            if (unit != UNIT_TOMBSTONE) free(unit);
+        }
+        free(table);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    epoch_free_all();
+}
+
+// --- Timer Wheel ---
+
+// Hierarchical timing wheel (Varghese & Lauck): four levels of 64 slots,
+// each level covering 64 times the span of the one below. Adding and
+// cancelling are O(1); advancing costs one slot per tick plus an
+// occasional cascade, and only touches timers that are due. An empty
+// wheel jumps straight to the present, so a long idle spell costs nothing.
+// The tick length is up to the owner. Not thread-safe: one thread owns
+// each wheel.
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_MAX_DELTA (((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1)
+
+typedef struct TimerWheel TimerWheel;
+
+typedef struct TimerNode {
+    struct TimerNode* prev;
+    struct TimerNode* next;
+    uint64_t expires; // Absolute tick
+    TimerWheel* wheel; // Wheel it is armed in, NULL once due or cancelled
+} TimerNode;
+
+struct TimerWheel {
+    uint64_t now; // Last tick processed
+    size_t armed; // Timers in the slots
+    TimerNode slots[WHEEL_LEVELS][WHEEL_SIZE]; // Circular list heads
+};
+
+static void timer_wheel_init(TimerWheel* w, uint64_t now) {
+    w->now = now;
+    w->armed = 0;
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        for (int i = 0; i < WHEEL_SIZE; i++) {
+            w->slots[l][i].prev = w->slots[l][i].next = &w->slots[l][i];
+        }
+    }
+}
+
+static void timer_list_append(TimerNode* head, TimerNode* node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+static void timer_wheel_place(TimerWheel* w, TimerNode* node) {
+    uint64_t delta = node->expires - w->now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << (WHEEL_BITS * (level + 1)))) level++;
+    size_t idx = (node->expires >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    timer_list_append(&w->slots[level][idx], node);
+}
+
+static void timer_wheel_add(TimerWheel* w, TimerNode* node, uint64_t expires) {
+    if (expires <= w->now) expires = w->now + 1; // Already due: fire on the next tick
+    if (expires - w->now > WHEEL_MAX_DELTA) expires = w->now + WHEEL_MAX_DELTA;
+    node->expires = expires;
+    node->wheel = w;
+    w->armed++;
+    timer_wheel_place(w, node);
+}
+
+// Unlinks the node from the wheel, or from the expired list it was moved to
+static void timer_wheel_cancel(TimerNode* node) {
+    if (!node->next) return;
+    if (node->wheel) {
+        node->wheel->armed--;
+        node->wheel = NULL;
+    }
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = NULL;
+}
+
+// Moves timers due at or before `now` onto the caller's `expired` list (a circular head)
+static void timer_wheel_advance(TimerWheel* w, uint64_t now, TimerNode* expired) {
+    while (w->now < now) {
+        if (w->armed == 0) { // Nothing can come due: no need to walk the slots
+            w->now = now;
+            break;
+        }
+        uint64_t tick = ++w->now;
+        // Entering a new lap of a level: pull the next slot of the level above down
+        for (int level = 1; level < WHEEL_LEVELS && ((tick >> (WHEEL_BITS * (level - 1))) & WHEEL_MASK) == 0; level++) {
+            TimerNode* head = &w->slots[level][(tick >> (WHEEL_BITS * level)) & WHEEL_MASK];
+            TimerNode* node = head->next;
+            head->prev = head->next = head;
+            while (node != head) {
+                TimerNode* next = node->next;
+                timer_wheel_place(w, node);
+                node = next;
             }
+        }
+        TimerNode* head = &w->slots[0][tick & WHEEL_MASK];
+        while (head->next != head) {
+            TimerNode* node = head->next;
+            timer_wheel_cancel(node);
+            timer_list_append(expired, node);
+        }
+    }
+}
+
+// Ticks until the earliest timer may be due, or -1 if the wheel is empty.
+// Exact for timers on level 0. A timer higher up is due no sooner than the
+// tick that cascades its slot, so each level's first occupied slot bounds
+// it: a timer minutes out costs a few wakeups, not one per level-0 lap.
+static int64_t timer_wheel_next_due(const TimerWheel* w) {
+    if (w->armed == 0) return -1;
+    int64_t next = -1;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        int shift = WHEEL_BITS * level;
+        uint64_t pos = w->now >> shift;
+        // Placement keeps every timer between one and WHEEL_SIZE slots ahead
+        for (uint64_t i = 1; i <= WHEEL_SIZE; i++) {
+            const TimerNode* head = &w->slots[level][(pos + i) & WHEEL_MASK];
+            if (head->next == head) continue;
+            int64_t due = (int64_t)(((pos + i) << shift) - w->now);
+            if (next < 0 || due < next) next = due;
             break;
         }
-        unit = unit->next;
     }
-    
-    pthread_mutex_unlock(&g_unit_list_mutex);
-    return found ? 0 : -1;
-}
+    return next;
+}
+
+// --- Unit Expiry ---
+
+// Every unit has one timer owned by the expiry thread. Heartbeats never
+// touch it: they only refresh last_seen. When a timer fires, the thread
+// compares against last_seen and either re-arms at the real deadline,
+// marks the unit offline and arms the eviction grace period, or evicts.
+// The only hand-off from other threads is a lock-free stack used to arm a
+// new unit's timer, or to wake one parked on its eviction deadline when the
+// unit comes back. Each heartbeat is O(1) and each tick is O(timers due).
+typedef enum {
+    EXPIRY_WATCH_ONLINE,
+    EXPIRY_WATCH_EVICT
+} ExpiryPhase;
+
+typedef struct UnitTimer {
+    TimerNode node; // First member: wheel lists hold TimerNode pointers
+    char name[128];
+    uint64_t hash;
+    ExpiryPhase phase;
+    _Atomic int queued;         // Already on the hand-off stack
+    struct UnitTimer* next_queued;
+} UnitTimer;
+
+static TimerWheel g_expiry_wheel;
+static _Atomic(UnitTimer*) g_expiry_inbox = NULL;
+static pthread_t g_expiry_thread;
+static pthread_mutex_t g_expiry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_expiry_cond = PTHREAD_COND_INITIALIZER;
+static int g_expiry_running = 0;
+
+static UnitTimer* create_unit_timer(const char* name, uint64_t hash) {
+    UnitTimer* timer = calloc(1, sizeof(UnitTimer));
+    if (!timer) return NULL;
+    memcpy(timer->name, name, sizeof(timer->name));
+    timer->hash = hash;
+    timer->phase = EXPIRY_WATCH_ONLINE;
+    return timer;
+}
+
+// Asks the expiry thread to re-evaluate a unit's timer on its next tick.
+// Called under the shard lock, which keeps the timer alive: eviction
+// frees it only after re-checking the unit under that same lock.
+static void request_expiry_check(UnitTimer* timer) {
+    if (atomic_exchange_explicit(&timer->queued, 1, memory_order_relaxed)) return;
+    UnitTimer* head = atomic_load_explicit(&g_expiry_inbox, memory_order_relaxed);
+    do {
+        timer->next_queued = head;
+    } while (!atomic_compare_exchange_weak_explicit(&g_expiry_inbox, &head, timer,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+static void expiry_fire(UnitTimer* timer, time_t now) {
+    time_t last_seen = unit_last_seen(timer->name, timer->hash);
+    if (last_seen == 0) { // Gone already
+        free(timer);
+        return;
+    }
+    time_t offline_at = last_seen + UNIT_TIMEOUT_SECONDS;
+    time_t evict_at = offline_at + g_config.offline_grace_seconds;
+
+    if (now < offline_at) {
+        // Heartbeats kept it alive (possibly back from offline): re-arm at the real deadline
+        timer->phase = EXPIRY_WATCH_ONLINE;
+        timer_wheel_add(&g_expiry_wheel, &timer->node, (uint64_t)offline_at);
+    } else if (timer->phase == EXPIRY_WATCH_ONLINE || now < evict_at) {
+        if (registry_mark_offline(timer->name, timer->hash, now - UNIT_TIMEOUT_SECONDS + 1)) {
+            emit_unit_event(UNIT_EVENT_OFFLINE, timer->name);
+        }
+        timer->phase = EXPIRY_WATCH_EVICT;
+        timer_wheel_add(&g_expiry_wheel, &timer->node, (uint64_t)evict_at);
+    } else if (registry_evict(timer->name, timer->hash, now - UNIT_TIMEOUT_SECONDS - g_config.offline_grace_seconds + 1)) {
+        emit_unit_event(UNIT_EVENT_EVICTED, timer->name);
+        free(timer);
+    } else {
+        // A heartbeat landed between our look and the eviction; check again next tick
+        timer->phase = EXPIRY_WATCH_ONLINE;
+        timer_wheel_add(&g_expiry_wheel, &timer->node, (uint64_t)now + 1);
+    }
+}
+
+static void* expiry_thread(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_expiry_lock);
+    while (g_expiry_running) {
+        pthread_mutex_unlock(&g_expiry_lock);
+        time_t now = time(NULL);
+
+        UnitTimer* queued = atomic_exchange_explicit(&g_expiry_inbox, NULL, memory_order_acquire);
+        while (queued) {
+            UnitTimer* next = queued->next_queued;
+            atomic_store_explicit(&queued->queued, 0, memory_order_relaxed);
+            timer_wheel_cancel(&queued->node);
+            expiry_fire(queued, now);
+            queued = next;
+        }
+
+        TimerNode expired;
+        expired.prev = expired.next = &expired;
+        timer_wheel_advance(&g_expiry_wheel, (uint64_t)now, &expired);
+        while (expired.next != &expired) {
+            TimerNode* node = expired.next;
+            timer_wheel_cancel(node);
+            expiry_fire((UnitTimer*)node, now);
+        }
+
+        pthread_mutex_lock(&g_expiry_lock);
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_sec += 1;
+        if (g_expiry_running) pthread_cond_timedwait(&g_expiry_cond, &g_expiry_lock, &wake);
+    }
+    pthread_mutex_unlock(&g_expiry_lock);
+    return NULL;
+}
+
+static int start_expiry_thread(void) {
+    timer_wheel_init(&g_expiry_wheel, (uint64_t)time(NULL));
+    g_expiry_running = 1;
+    return pthread_create(&g_expiry_thread, NULL, expiry_thread, NULL) == 0 ? 0 : -1;
+}
+
+static void stop_expiry_thread(void) {
+    pthread_mutex_lock(&g_expiry_lock);
+    g_expiry_running = 0;
+    pthread_cond_signal(&g_expiry_cond);
+    pthread_mutex_unlock(&g_expiry_lock);
+    pthread_join(g_expiry_thread, NULL);
+
+    // Release every timer still waiting on the hand-off stack or armed in the wheel
+    UnitTimer* queued = atomic_exchange(&g_expiry_inbox, NULL);
+    while (queued) {
+        UnitTimer* next = queued->next_queued;
+        timer_wheel_cancel(&queued->node);
+        free(queued);
+        queued = next;
+    }
+    for (int l = 0; l < WHEEL_LEVELS; l++) {
+        for (int i = 0; i < WHEEL_SIZE; i++) {
+            TimerNode* head = &g_expiry_wheel.slots[l][i];
+            while (head->next != head) {
+                TimerNode* node = head->next;
+                timer_wheel_cancel(node);
+                free(node);
+            }
+        }
+    }
+}
+
+// --- /units Snapshot ---
+
+// The serialized /units body is cached together with the registry
+// generation it was built from. Requests share it by reference; the first
+// one to notice a newer generation rebuilds it from a lock-free registry
+// walk, so serving /units never blocks registrations.
+typedef struct {
+    _Atomic int refs; // The published pointer holds one; freed (via epoch_retire) at zero
+    uint64_t generation;
+    size_t len;
+    char body[];
+} UnitsSnapshot;
+
+static _Atomic(UnitsSnapshot*) g_units_snapshot = NULL;
+static pthread_mutex_t g_units_rebuild_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+    char* buf;
+    size_t len;
+    size_t cap;
+    int failed;
+} JsonOut;
+
+static void json_out_append(JsonOut* out, const char* s, size_t len) {
+    if (out->failed) return;
+    if (out->len + len + 1 > out->cap) {
+        size_t cap = out->cap ? out->cap : 256;
+        while (out->len + len + 1 > cap) cap *= 2;
+        char* grown = realloc(out->buf, cap);
+        if (!grown) { out->failed = 1; return; }
+        out->buf = grown;
+        out->cap = cap;
+    }
+    memcpy(out->buf + out->len, s, len);
+    out->len += len;
+}
+
+// Appends a JSON string literal, escaped the same way ctz_json_stringify does
+static void json_out_string(JsonOut* out, const char* s) {
+    json_out_append(out, "\"", 1);
+    const char* run = s;
+    for (; *s; s++) {
+        unsigned char ch = (unsigned char)*s;
+        if (ch >= 0x20 && ch != '"' && ch != '\\') continue;
+        json_out_append(out, run, s - run);
+        char esc[7];
+        switch (ch) {
+            case '"':  json_out_append(out, "\\\"", 2); break;
+            case '\\': json_out_append(out, "\\\\", 2); break;
+            case '\b': json_out_append(out, "\\b", 2); break;
+            case '\f': json_out_append(out, "\\f", 2); break;
+            case '\n': json_out_append(out, "\\n", 2); break;
+            case '\r': json_out_append(out, "\\r", 2); break;
+            case '\t': json_out_append(out, "\\t", 2); break;
+            default:
+                snprintf(esc, sizeof(esc), "\\u%04X", ch);
+                json_out_append(out, esc, 6);
+                break;
+        }
+        run = s + 1;
+    }
+    json_out_append(out, run, s - run);
+    json_out_append(out, "\"", 1);
+}
+
+static void append_unit_entry(const Unit* u, void* arg) {
+    JsonOut* out = arg;
+    json_out_append(out, out->len > 1 ? ",{\"name\":" : "{\"name\":", out->len > 1 ? 9 : 8);
+    json_out_string(out, u->name);
+    if (atomic_load_explicit(&u->online, memory_order_relaxed)) {
+        json_out_append(out, ",\"status\":\"online\"}", 19);
+    } else {
+        json_out_append(out, ",\"status\":\"offline\"}", 20);
+    }
+}
+
+static UnitsSnapshot* build_units_snapshot(uint64_t generation) {
+    JsonOut out = { NULL, 0, 0, 0 };
+    json_out_append(&out, "[", 1);
+    registry_for_each(append_unit_entry, &out);
+    json_out_append(&out, "]", 1);
+    UnitsSnapshot* snap = out.failed ? NULL : malloc(sizeof(UnitsSnapshot) + out.len + 1);
+    if (snap) {
+        atomic_init(&snap->refs, 1);
+        snap->generation = generation;
+        snap->len = out.len;
+        memcpy(snap->body, out.buf, out.len);
+        snap->body[out.len] = '\0';
+    }
+    free(out.buf);
+    return snap;
+}
+
+static void units_snapshot_release(void* arg) {
+    UnitsSnapshot* snap = arg;
+    if (atomic_fetch_sub_explicit(&snap->refs, 1, memory_order_acq_rel) == 1) {
+        epoch_retire(snap); // A reader may have loaded the pointer and not yet taken its reference
+    }
+}
+
+// Takes a reference on the published snapshot, or returns NULL if there is none
+static UnitsSnapshot* units_snapshot_acquire(void) {
+    epoch_enter();
+    UnitsSnapshot* snap = atomic_load_explicit(&g_units_snapshot, memory_order_acquire);
+    while (snap) {
+        int refs = atomic_load_explicit(&snap->refs, memory_order_relaxed);
+        // Never revive one whose count already hit zero; reload the replacement instead
+        if (refs > 0 && atomic_compare_exchange_weak_explicit(&snap->refs, &refs, refs + 1,
+                                                              memory_order_acquire, memory_order_relaxed)) {
+            break;
+        }
+        if (refs == 0) snap = atomic_load_explicit(&g_units_snapshot, memory_order_acquire);
+    }
+    epoch_exit();
+    return snap;
+}
+
+// Returns a referenced snapshot no older than the registry generation at
+// call time, unless another thread is already rebuilding and an older one
+// exists; then that one is served rather than waiting.
+static UnitsSnapshot* get_units_snapshot(void) {
+    uint64_t generation = atomic_load_explicit(&g_registry_generation, memory_order_acquire);
+    UnitsSnapshot* snap = units_snapshot_acquire();
+    if (snap && snap->generation == generation) return snap;
+
+    if (snap && pthread_mutex_trylock(&g_units_rebuild_lock) != 0) return snap;
+    if (!snap) pthread_mutex_lock(&g_units_rebuild_lock);
+
+    // Someone may have published while we waited for the lock
+    UnitsSnapshot* current = units_snapshot_acquire();
+    generation = atomic_load_explicit(&g_registry_generation, memory_order_acquire);
+    if (current && current->generation == generation) {
+        pthread_mutex_unlock(&g_units_rebuild_lock);
+        if (snap) units_snapshot_release(snap);
+        return current;
+    }
+    if (current) units_snapshot_release(current);
+
+    UnitsSnapshot* fresh = build_units_snapshot(generation);
+    if (fresh) {
+        atomic_fetch_add_explicit(&fresh->refs, 1, memory_order_relaxed); // Caller's reference
+        UnitsSnapshot* old = atomic_exchange_explicit(&g_units_snapshot, fresh, memory_order_acq_rel);
+        if (old) units_snapshot_release(old);
+    }
+    pthread_mutex_unlock(&g_units_rebuild_lock);
+
+    if (!fresh) return snap; // Out of memory: stale beats nothing
+    if (snap) units_snapshot_release(snap);
+    return fresh;
+}
+
+static void units_snapshot_free(void) {
+    UnitsSnapshot* snap = atomic_exchange(&g_units_snapshot, NULL);
+    free(snap);
+}
+
+// --- Registry Change Feed ---
+
+// Every unit event is numbered with the registry revision it creates and
+// kept in a bounded ring, so GET /units/watch can return just the changes
+// after a revision the client already has. Revisions are contiguous, which
+// makes finding the first event after `since` a single index computation.
+// A client that falls further behind than the ring holds gets a 410 and
+// has to start over from GET /units.
+#define UNIT_FEED_SIZE 8192 // Power of two
+#define UNIT_FEED_MAX_EVENTS 1024 // Per response; the client continues from the revision it got
+#define WATCH_DEFAULT_TIMEOUT_SECONDS 30
+#define WATCH_MAX_TIMEOUT_SECONDS 300
+
+typedef struct {
+    UnitEvent type;
+    char name[128];
+} UnitFeedEntry;
+
+static UnitFeedEntry g_unit_feed[UNIT_FEED_SIZE]; // Revision r lives at r % UNIT_FEED_SIZE
+static pthread_mutex_t g_unit_feed_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic int g_watcher_count = 0; // Parked watchers; events only wake the reactor if there are any
+
+static const char* const g_unit_event_names[] = { "added", "updated", "online", "offline", "evicted" };
+
+static void wake_reactor(void);
+
+// Called after a change is published: bumps the revision so cached views
+// rebuild, records the event in the feed, and reports it
+static void emit_unit_event(UnitEvent event, const char* name) {
+    pthread_mutex_lock(&g_unit_feed_lock);
+    // seq_cst: the bump must be ordered before the g_watcher_count load below
+    uint64_t revision = atomic_fetch_add(&g_registry_generation, 1) + 1;
+    UnitFeedEntry* entry = &g_unit_feed[revision & (UNIT_FEED_SIZE - 1)];
+    entry->type = event;
+    strncpy(entry->name, name, sizeof(entry->name) - 1);
+    entry->name[sizeof(entry->name) - 1] = '\0';
+    pthread_mutex_unlock(&g_unit_feed_lock);
+
+    // A watcher parking concurrently re-reads the revision after counting
+    // itself; with both sides seq_cst, one of us sees the other
+    if (atomic_load(&g_watcher_count) > 0) wake_reactor();
+    // registration_finish logs additions and address changes
+    if (event != UNIT_EVENT_ADDED && event != UNIT_EVENT_UPDATED) {
+        log_msg("Unit %s: %s", g_unit_event_names[event], name);
+    }
+}
+
+// Appends {"revision":R,"events":[...]} with the events after `since`, R
+// being the newest one included (the current revision if there are none).
+// Returns how many were included, or -1 if `since` is older than the ring
+// reaches or newer than the registry (e.g. from before a restart).
+static int unit_feed_read(uint64_t since, JsonOut* out) {
+    if (since < 1) since = 1; // Revision 1 is the empty registry, before any event
+    pthread_mutex_lock(&g_unit_feed_lock);
+    uint64_t current = atomic_load_explicit(&g_registry_generation, memory_order_relaxed);
+    if (since > current || current - since > UNIT_FEED_SIZE) {
+        pthread_mutex_unlock(&g_unit_feed_lock);
+        return -1;
+    }
+    uint64_t last = current - since > UNIT_FEED_MAX_EVENTS ? since + UNIT_FEED_MAX_EVENTS : current;
+    char text[64];
+    int len = snprintf(text, sizeof(text), "{\"revision\":%llu,\"events\":[", (unsigned long long)last);
+    json_out_append(out, text, len);
+    for (uint64_t rev = since + 1; rev <= last; rev++) {
+        const UnitFeedEntry* entry = &g_unit_feed[rev & (UNIT_FEED_SIZE - 1)];
+        len = snprintf(text, sizeof(text), "%s{\"revision\":%llu,\"type\":\"%s\",\"unit_name\":",
+                       rev > since + 1 ? "," : "", (unsigned long long)rev, g_unit_event_names[entry->type]);
+        json_out_append(out, text, len);
+        json_out_string(out, entry->name);
+        json_out_append(out, "}", 1);
+    }
+    pthread_mutex_unlock(&g_unit_feed_lock);
+    json_out_append(out, "]}", 2);
+    return (int)(last - since);
+}
+
+// --- Buffer Pool ---
+
+// Request buffers come in power-of-two size classes from 4 KB up to 64 MB
+// (enough for MAX_HTTP_BODY_SIZE plus headers). Each thread keeps a small
+// free list per class, so a connection starts with a 4 KB header buffer and
+// only moves to a bigger class once Content-Length says it needs one.
+#define BUFFER_POOL_MIN_SHIFT 12
+#define BUFFER_POOL_MAX_SHIFT 26
+#define BUFFER_POOL_CLASSES (BUFFER_POOL_MAX_SHIFT - BUFFER_POOL_MIN_SHIFT + 1)
+#define BUFFER_POOL_CACHE_BYTES (4 * 1024 * 1024) // Per class, per thread
+#define BUFFER_POOL_MAX_CACHED_SIZE (1024 * 1024) // Larger buffers go straight back to malloc
+
+typedef struct PooledBuffer {
+    struct PooledBuffer* next;
+} PooledBuffer;
+
+typedef struct {
+    PooledBuffer* free_list[BUFFER_POOL_CLASSES];
+    size_t cached[BUFFER_POOL_CLASSES];
+} BufferPool;
+
+static __thread BufferPool t_buffer_pool;
+
+static int buffer_class_for(size_t size) {
+    int cls = 0;
+    while (cls < BUFFER_POOL_CLASSES && ((size_t)1 << (cls + BUFFER_POOL_MIN_SHIFT)) < size) cls++;
+    return cls; // == BUFFER_POOL_CLASSES when the request exceeds the largest class
+}
+
+// Returns a buffer of at least min_size bytes and stores its real capacity in cap_out
+static char* buffer_pool_get(size_t min_size, size_t* cap_out) {
+    int cls = buffer_class_for(min_size);
+    if (cls == BUFFER_POOL_CLASSES) {
+        *cap_out = min_size;
+        return malloc(min_size);
+    }
+    size_t size = (size_t)1 << (cls + BUFFER_POOL_MIN_SHIFT);
+    PooledBuffer* buf = t_buffer_pool.free_list[cls];
+    if (buf) {
+        t_buffer_pool.free_list[cls] = buf->next;
+        t_buffer_pool.cached[cls]--;
+    } else {
+        buf = malloc(size);
+        if (!buf) return NULL;
+    }
+    *cap_out = size;
+    return (char*)buf;
+}
+
+static void buffer_pool_put(char* data, size_t cap) {
+    if (!data) return;
+    int cls = buffer_class_for(cap);
+    if (cls == BUFFER_POOL_CLASSES || cap != ((size_t)1 << (cls + BUFFER_POOL_MIN_SHIFT)) ||
+        cap > BUFFER_POOL_MAX_CACHED_SIZE || (t_buffer_pool.cached[cls] + 1) * cap > BUFFER_POOL_CACHE_BYTES) {
+        free(data);
+        return;
+    }
+    PooledBuffer* buf = (PooledBuffer*)data;
+    buf->next = t_buffer_pool.free_list[cls];
+    t_buffer_pool.free_list[cls] = buf;
+    t_buffer_pool.cached[cls]++;
+}
+
+static void buffer_pool_drain(void) {
+    for (int cls = 0; cls < BUFFER_POOL_CLASSES; cls++) {
+        while (t_buffer_pool.free_list[cls]) {
+            PooledBuffer* next = t_buffer_pool.free_list[cls]->next;
+            free(t_buffer_pool.free_list[cls]);
+            t_buffer_pool.free_list[cls] = next;
+        }
+        t_buffer_pool.cached[cls] = 0;
+    }
+}
+
+// --- Connection State ---
+
+typedef enum {
+    CONN_READING,    // Reactor is collecting request bytes
+    CONN_DISPATCHED, // A worker owns the connection until it completes
+    CONN_PROXYING,   // Reactor is running the handler's upstream call
+    CONN_WATCHING,   // Parked on GET /units/watch until a change or its timeout
+    CONN_WRITING,    // Reactor is flushing the response
+    CONN_CLOSED      // Waiting to be freed after the current batch of events
+} ConnState;
+
+// First member of every epoll payload other than the two sentinels
+typedef enum {
+    EVENT_CLIENT,
+    EVENT_UPSTREAM
+} EventSource;
+
+typedef struct Connection {
+    EventSource source; // EVENT_CLIENT; first member
+    int sock_fd;
+    NetAddr peer;
+    char ip_addr[64];
+    ConnState state;
+    int peer_closed; // Hung up while a worker held the connection
+    int keep_alive;  // Decided per request from the version, Connection header and request cap
+    int requests_served;
+    uint64_t last_active_ms;
+    struct Connection* idle_prev; // Idle list, oldest activity first
+    struct Connection* idle_next;
+
+    // Pooled request buffer: header-sized until the headers are in, then sized
+    // to the declared Content-Length. Pipelined requests that follow the
+    // current one stay queued behind it.
+    char* in_buf;
+    size_t in_len;
+    size_t in_cap;
+    size_t header_len;     // Bytes up to and including "\r\n\r\n", 0 until seen
+    size_t content_length;
+    char saved_byte;       // First byte of the next request, overwritten by the body terminator
+
+    // Parsed request (points into in_buf)
+    char* method;
+    char* path;
+    char* body;
+    size_t body_len;
+    int route; // MetricsRoute, decided once the request is read
+    uint64_t request_started_us;
+
+    // Response: headers (plus small bodies) in out_buf, optionally followed
+    // by a borrowed body that is released once written
+    char* out_buf;
+    size_t out_len;
+    const char* out_body;
+    size_t out_body_len;
+    void (*out_body_release)(void* ctx);
+    void* out_body_ctx;
+    size_t out_sent; // Across out_buf, then out_body
+    int status;      // Of the response being sent, for metrics
+
+    struct UpstreamCall* upstream; // Set by the handler when the response comes from a unit
+    struct Watch* watch;           // Set by the handler when the response waits for registry changes
+    struct SyncFanout* fanout;     // Set by the handler for a /sync to several units
+    struct NodesWait* nodes;       // Set by the handler for a /nodes answered from the cache
+
+    struct Connection* next_done; // Link in the completion stack, then the reap list once closed
+} Connection;
+
+static int g_epoll_fd = -1;
+static int g_wake_fd = -1;  // eventfd poked by workers when a response is ready
+static _Atomic(Connection*) g_done_head = NULL;
+static Connection* g_idle_head = NULL;
+static Connection* g_idle_tail = NULL;
+static Connection* g_closed_head = NULL;
+
+#define REACTOR_MAX_EVENTS 256
+#define HEADER_BUFFER_SIZE 4096 // Initial per-connection buffer; enough for typical request headers
+#define MAX_HEADER_SIZE (16 * 1024)
+
+// Sentinel epoll payloads for the two non-connection descriptors
+static int g_listen_tag;
+static int g_wake_tag;
+
+static void release_response(Connection* conn) {
+    free(conn->out_buf);
+    if (conn->out_body_release) conn->out_body_release(conn->out_body_ctx);
+    conn->out_buf = NULL;
+    conn->out_len = conn->out_body_len = conn->out_sent = 0;
+    conn->out_body = NULL;
+    conn->out_body_release = NULL;
+    conn->out_body_ctx = NULL;
+}
+
+// Builds the status line and headers, with room for `inline_len` body bytes after them
+static char* build_response_head(Connection* conn, const char* status_line, const char* content_type,
+                                 size_t body_len, size_t inline_len, size_t* head_len) {
+    size_t cap = strlen(status_line) + strlen(content_type) + inline_len + 128;
+    char* response = malloc(cap);
+    if (!response) return NULL;
+    conn->status = atoi(status_line + 9); // "HTTP/1.1 NNN ..."
+    *head_len = snprintf(response, cap,
+        "%s\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: %s\r\n\r\n",
+        status_line, content_type, body_len, conn->keep_alive ? "keep-alive" : "close"
+    );
+    return response;
+}
+
+// Helper to send a simple HTTP response (buffered on the connection, flushed by the reactor)
+void send_response(Connection* conn, const char* status_line, const char* content_type, const char* body) {
+    size_t body_len = strlen(body);
+    size_t header_len;
+    release_response(conn);
+    char* response = build_response_head(conn, status_line, content_type, body_len, body_len, &header_len);
+    if (!response) return;
+    memcpy(response + header_len, body, body_len);
+    conn->out_buf = response;
+    conn->out_len = header_len + body_len;
+}
+
+// Sends a body the caller shares rather than copies; release(ctx) runs once it has been written
+static void send_response_shared(Connection* conn, const char* status_line, const char* content_type,
+                                 const char* body, size_t body_len, void (*release)(void*), void* ctx) {
+    size_t header_len;
+    release_response(conn);
+    char* response = build_response_head(conn, status_line, content_type, body_len, 0, &header_len);
+    if (!response) {
+        release(ctx);
+        return;
+    }
+    conn->out_buf = response;
+    conn->out_len = header_len;
+    conn->out_body = body;
+    conn->out_body_len = body_len;
+    conn->out_body_release = release;
+    conn->out_body_ctx = ctx;
+}
+
+// --- Metrics ---
+
+// Counters behind GET /metrics. Every thread that records anything gets its
+// own cache-line aligned shard, claimed on first use, and is its only
+// writer: an update is a relaxed load and store to memory no other thread
+// writes, with no lock and no contended cache line. A scrape sums the
+// shards with relaxed loads, so it may be a few updates behind but never
+// sees a torn value. Latencies go into log-linear histograms: two buckets
+// per power of two from 16 us to about 33 s, which keeps every bucket
+// within 50% of its neighbours and a whole histogram at 44 counters.
+
+#define METRICS_MAX_SHARDS (MAX_WORKER_THREADS + 4) // Workers, reactor, expiry thread
+#define METRICS_BUCKETS 44 // 16 us, then 24, 32, 48, 64 us ... 2^25 us, then +Inf
+#define METRICS_UPSTREAM_RESULTS 4 // One per UpstreamResult
+
+typedef enum {
+    ROUTE_REGISTER,
+    ROUTE_REGISTER_BATCH,
+    ROUTE_UNITS,
+    ROUTE_UNITS_WATCH,
+    ROUTE_NODES,
+    ROUTE_SYNC,
+    ROUTE_RESOLVE,
+    ROUTE_METRICS,
+    ROUTE_OTHER, // Unknown paths and requests rejected before routing
+    ROUTE_COUNT
+} MetricsRoute;
+
+static const char* const g_route_names[ROUTE_COUNT] = {
+    "/register", "/register/batch", "/units", "/units/watch", "/nodes", "/sync", "/resolve", "/metrics", "other"
+};
+
+// Status codes the coordinator sends; anything else is counted under the last slot
+static const int g_status_codes[] = { 200, 400, 404, 410, 413, 431, 500, 502, 503, 504, 0 };
+#define METRICS_STATUSES (sizeof(g_status_codes) / sizeof(g_status_codes[0]))
+
+static const char* const g_upstream_result_names[METRICS_UPSTREAM_RESULTS] = {
+    "ok", "failed", "timed_out", "too_large"
+};
+
+typedef struct {
+    _Atomic uint64_t buckets[METRICS_BUCKETS];
+    _Atomic uint64_t sum_us;
+} Histogram;
+
+typedef struct {
+    _Atomic uint64_t requests[ROUTE_COUNT][METRICS_STATUSES];
+    Histogram request_latency[ROUTE_COUNT];
+    _Atomic uint64_t upstream_calls[ROUTE_COUNT][METRICS_UPSTREAM_RESULTS];
+    Histogram upstream_latency[ROUTE_COUNT];
+    _Atomic uint64_t connections_opened;
+    _Atomic uint64_t connections_closed;
+    _Atomic uint64_t bytes_in;
+    _Atomic uint64_t bytes_out;
+} __attribute__((aligned(64))) MetricsShard;
+
+static _Atomic(MetricsShard*) g_metrics_shards[METRICS_MAX_SHARDS];
+static _Atomic int g_metrics_shard_count = 0;
+static MetricsShard g_metrics_overflow; // Shared by threads past the limit, which lose the odd update
+static __thread MetricsShard* t_metrics;
+
+static MetricsShard* metrics_shard(void) {
+    if (t_metrics) return t_metrics;
+    int index = atomic_fetch_add(&g_metrics_shard_count, 1);
+    MetricsShard* shard = index < METRICS_MAX_SHARDS ? aligned_alloc(64, sizeof(MetricsShard)) : NULL;
+    if (shard) {
+        memset(shard, 0, sizeof(MetricsShard));
+        atomic_store_explicit(&g_metrics_shards[index], shard, memory_order_release);
+    }
+    t_metrics = shard ? shard : &g_metrics_overflow;
+    return t_metrics;
+}
+
+// Single writer per shard, so no read-modify-write instruction is needed
+static inline void metric_add(_Atomic uint64_t* counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// Upper bound of bucket i in microseconds
+static uint64_t metrics_bucket_bound(int i) {
+    if (i == 0) return 16;
+    int k = 4 + (i - 1) / 2;
+    return i % 2 ? 3ull << (k - 1) : 1ull << (k + 1);
+}
+
+static int metrics_bucket(uint64_t us) {
+    if (us <= 16) return 0;
+    if (us > (1ull << 25)) return METRICS_BUCKETS - 1;
+    int k = 63 - __builtin_clzll(us - 1); // us is in (2^k, 2^(k+1)]
+    return (k - 4) * 2 + 1 + (us - 1 >= 3ull << (k - 1));
+}
+
+static void histogram_record(Histogram* h, uint64_t us) {
+    metric_add(&h->buckets[metrics_bucket(us)], 1);
+    metric_add(&h->sum_us, us);
+}
+
+static MetricsRoute metrics_route(const char* method, const char* path) {
+    if (!method || !path) return ROUTE_OTHER;
+    size_t len = strcspn(path, "?");
+    if (strcmp(method, "POST") == 0) {
+        if (len == 9 && strncmp(path, "/register", len) == 0) return ROUTE_REGISTER;
+        if (len == 15 && strncmp(path, "/register/batch", len) == 0) return ROUTE_REGISTER_BATCH;
+        if (len == 5 && strncmp(path, "/sync", len) == 0) return ROUTE_SYNC;
+    } else if (strcmp(method, "GET") == 0) {
+        if (len == 6 && strncmp(path, "/units", len) == 0) return ROUTE_UNITS;
+        if (len == 12 && strncmp(path, "/units/watch", len) == 0) return ROUTE_UNITS_WATCH;
+        if (len == 6 && strncmp(path, "/nodes", len) == 0) return ROUTE_NODES;
+        if (len == 8 && strncmp(path, "/resolve", len) == 0) return ROUTE_RESOLVE;
+        if (len == 8 && strncmp(path, "/metrics", len) == 0) return ROUTE_METRICS;
+    }
+    return ROUTE_OTHER;
+}
+
+static void metrics_request_done(int route, int status, uint64_t started_us) {
+    MetricsShard* shard = metrics_shard();
+    size_t code = 0;
+    while (g_status_codes[code] && g_status_codes[code] != status) code++;
+    metric_add(&shard->requests[route][code], 1);
+    histogram_record(&shard->request_latency[route], monotonic_us() - started_us);
+}
+
+static void metrics_upstream_done(int route, int result, uint64_t started_us) {
+    MetricsShard* shard = metrics_shard();
+    metric_add(&shard->upstream_calls[route][result], 1);
+    histogram_record(&shard->upstream_latency[route], monotonic_us() - started_us);
+}
+
+static void metrics_printf(JsonOut* out, const char* format, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n > 0) json_out_append(out, line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1);
+}
+
+typedef struct {
+    uint64_t online;
+    uint64_t offline;
+} UnitCounts;
+
+static void count_unit(const Unit* u, void* arg) {
+    UnitCounts* counts = arg;
+    if (atomic_load_explicit(&u->online, memory_order_relaxed)) counts->online++;
+    else counts->offline++;
+}
+
+static uint64_t shard_counter(MetricsShard* shard, size_t offset) {
+    return atomic_load_explicit((_Atomic uint64_t*)((char*)shard + offset), memory_order_relaxed);
+}
+
+// Sums one counter, given by its byte offset in a shard, over every shard
+static uint64_t metrics_sum(size_t offset) {
+    uint64_t total = shard_counter(&g_metrics_overflow, offset);
+    int count = atomic_load(&g_metrics_shard_count);
+    for (int i = 0; i < count && i < METRICS_MAX_SHARDS; i++) {
+        MetricsShard* shard = atomic_load_explicit(&g_metrics_shards[i], memory_order_acquire);
+        if (shard) total += shard_counter(shard, offset);
+    }
+    return total;
+}
+
+#define METRICS_SUM(field) metrics_sum(offsetof(MetricsShard, field))
+
+static void metrics_histogram(JsonOut* out, const char* name, const char* route, size_t offset) {
+    uint64_t cumulative = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        cumulative += metrics_sum(offset + offsetof(Histogram, buckets[i]));
+        if (i < METRICS_BUCKETS - 1) {
+            metrics_printf(out, "%s_bucket{route=\"%s\",le=\"%.6f\"} %llu\n", name, route,
+                           metrics_bucket_bound(i) / 1e6, (unsigned long long)cumulative);
+        } else {
+            metrics_printf(out, "%s_bucket{route=\"%s\",le=\"+Inf\"} %llu\n", name, route, (unsigned long long)cumulative);
+        }
+    }
+    metrics_printf(out, "%s_sum{route=\"%s\"} %.6f\n", name, route, metrics_sum(offset + offsetof(Histogram, sum_us)) / 1e6);
+    metrics_printf(out, "%s_count{route=\"%s\"} %llu\n", name, route, (unsigned long long)cumulative);
+}
+
+// Renders every metric in the Prometheus text format. Routes that have seen
+// no traffic yet are left out of the per-route series.
+static void metrics_render(JsonOut* out) {
+    metrics_printf(out, "# HELP exodus_requests_total Requests answered, by route and status code.\n"
+                        "# TYPE exodus_requests_total counter\n");
+    uint64_t route_requests[ROUTE_COUNT] = { 0 };
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        for (size_t c = 0; c < METRICS_STATUSES; c++) {
+            uint64_t n = METRICS_SUM(requests[r][c]);
+            if (n == 0) continue;
+            route_requests[r] += n;
+            if (g_status_codes[c]) {
+                metrics_printf(out, "exodus_requests_total{route=\"%s\",code=\"%d\"} %llu\n",
+                               g_route_names[r], g_status_codes[c], (unsigned long long)n);
+            } else {
+                metrics_printf(out, "exodus_requests_total{route=\"%s\",code=\"other\"} %llu\n",
+                               g_route_names[r], (unsigned long long)n);
+            }
+        }
+    }
+    metrics_printf(out, "# HELP exodus_request_duration_seconds From a request being read to its response being written.\n"
+                        "# TYPE exodus_request_duration_seconds histogram\n");
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        if (route_requests[r] == 0) continue;
+        metrics_histogram(out, "exodus_request_duration_seconds", g_route_names[r],
+                          offsetof(MetricsShard, request_latency[r]));
+    }
+
+    uint64_t route_calls[ROUTE_COUNT] = { 0 };
+    metrics_printf(out, "# HELP exodus_upstream_calls_total Calls made to units, by route and outcome.\n"
+                        "# TYPE exodus_upstream_calls_total counter\n");
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        for (int res = 0; res < METRICS_UPSTREAM_RESULTS; res++) {
+            uint64_t n = METRICS_SUM(upstream_calls[r][res]);
+            if (n == 0) continue;
+            route_calls[r] += n;
+            metrics_printf(out, "exodus_upstream_calls_total{route=\"%s\",result=\"%s\"} %llu\n",
+                           g_route_names[r], g_upstream_result_names[res], (unsigned long long)n);
+        }
+    }
+    metrics_printf(out, "# HELP exodus_upstream_duration_seconds From a call to a unit being started to its end.\n"
+                        "# TYPE exodus_upstream_duration_seconds histogram\n");
+    for (int r = 0; r < ROUTE_COUNT; r++) {
+        if (route_calls[r] == 0) continue;
+        metrics_histogram(out, "exodus_upstream_duration_seconds", g_route_names[r],
+                          offsetof(MetricsShard, upstream_latency[r]));
+    }
+
+    UnitCounts units = { 0, 0 };
+    registry_for_each(count_unit, &units);
+    uint64_t opened = METRICS_SUM(connections_opened);
+    uint64_t closed = METRICS_SUM(connections_closed);
+    metrics_printf(out, "# HELP exodus_units Registered units, by state.\n"
+                        "# TYPE exodus_units gauge\n"
+                        "exodus_units{state=\"online\"} %llu\n"
+                        "exodus_units{state=\"offline\"} %llu\n",
+                   (unsigned long long)units.online, (unsigned long long)units.offline);
+    metrics_printf(out, "# HELP exodus_connections_active Client connections open.\n"
+                        "# TYPE exodus_connections_active gauge\n"
+                        "exodus_connections_active %llu\n",
+                   (unsigned long long)(opened > closed ? opened - closed : 0));
+    metrics_printf(out, "# HELP exodus_connections_accepted_total Client connections accepted.\n"
+                        "# TYPE exodus_connections_accepted_total counter\n"
+                        "exodus_connections_accepted_total %llu\n", (unsigned long long)opened);
+    metrics_printf(out, "# HELP exodus_received_bytes_total Bytes read from clients.\n"
+                        "# TYPE exodus_received_bytes_total counter\n"
+                        "exodus_received_bytes_total %llu\n", (unsigned long long)METRICS_SUM(bytes_in));
+    metrics_printf(out, "# HELP exodus_sent_bytes_total Bytes written to clients.\n"
+                        "# TYPE exodus_sent_bytes_total counter\n"
+                        "exodus_sent_bytes_total %llu\n", (unsigned long long)METRICS_SUM(bytes_out));
+}
+
+// --- Upstream Proxy ---
+
+// /nodes and /sync are proxied to units without tying up a thread. A worker
+// only builds the upstream request and attaches it to the client connection
+// as an UpstreamCall; the reactor then connects, writes and reads the
+// response over non-blocking sockets and fills in the client's response
+// when the call ends. Every call carries connect, first-byte and total
+// deadlines on a millisecond timer wheel, and missing one answers 504.
+//
+// Sockets to units are pooled per ip:port and reused most recently used
+// first. A host at its connection cap queues further calls until a socket
+// frees up. Responses are framed by Content-Length or chunked encoding so
+// the socket can be reused afterwards. A streaming call relays the body to
+// the client as it arrives, through a fixed-size buffer and with the unit's
+// framing passed through, so any size of response fits in constant memory;
+// the unit is only read while the client keeps up. Host entries live until
+// shutdown; there is one per ip:port ever contacted. Everything here runs on
+// the reactor thread, except upstream_call_create.
+
+#define UPSTREAM_POOL_BUCKETS 64 // Power of two
+#define UPSTREAM_IDLE_MS 15000 // Pooled sockets unused for longer are closed instead of reused
+#define UPSTREAM_MAX_HEADER_SIZE (16 * 1024)
+#define UPSTREAM_RELAY_SIZE (64 * 1024) // Per streaming call; holds a whole response head
+#define UPSTREAM_NO_DEADLINE UINT64_MAX
+
+typedef enum {
+    UPSTREAM_OK,
+    UPSTREAM_FAILED,   // Unreachable, reset, malformed or not a 200
+    UPSTREAM_TIMED_OUT,
+    UPSTREAM_TOO_LARGE // Buffered response over the call's max_response
+} UpstreamResult;
+
+typedef enum {
+    UPSTREAM_BUFFERED, // The done callback gets the whole decoded body
+    UPSTREAM_STREAM    // A 200's body is relayed to the client as it arrives
+} UpstreamMode;
+
+typedef enum {
+    CALL_QUEUED,     // Waiting for a connection slot on its host
+    CALL_CONNECTING,
+    CALL_SENDING,
+    CALL_RECEIVING
+} CallPhase;
+
+typedef enum {
+    FRAME_HEAD,
+    FRAME_LENGTH,
+    FRAME_CHUNK_SIZE,
+    FRAME_CHUNK_DATA,
+    FRAME_CHUNK_END,
+    FRAME_TRAILERS,
+    FRAME_EOF,
+    FRAME_DONE
+} FramePhase;
+
+typedef struct UpstreamHost UpstreamHost;
+typedef struct UpstreamCall UpstreamCall;
+
+typedef struct UpstreamConn {
+    EventSource source; // EVENT_UPSTREAM; first member
+    int fd;             // -1 once closed
+    UpstreamHost* host;
+    UpstreamCall* call; // NULL while idle
+    uint64_t idle_since_ms;
+    struct UpstreamConn* next; // Idle list, or the reap list once closed
+} UpstreamConn;
+
+struct UpstreamHost {
+    NetAddr addr;
+    UpstreamConn* idle; // Most recently used first
+    int idle_count;
+    int open_count;     // Idle plus busy
+    UpstreamCall* queued_head; // Calls waiting for a slot, oldest first
+    UpstreamCall* queued_tail;
+    UpstreamHost* next;
+};
+
+typedef struct {
+    int status;
+    char* body; // NUL-terminated; the done callback takes ownership
+    size_t body_len;
+} UpstreamResponse;
+
+typedef void (*UpstreamDone)(Connection* conn, UpstreamResult result, UpstreamResponse* resp);
+
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} UpstreamBuf;
+
+struct UpstreamCall {
+    TimerNode node; // First member: wheel lists hold TimerNode pointers
+    Connection* client;
+    UpstreamDone done; // Not called once a streamed response has been committed
+    struct SyncFanout* fanout; // Set instead of client/done for one call of a fan-out /sync
+    size_t fanout_index;
+    struct NodesCacheEntry* cache; // Set instead of client/done for a /nodes cache fill
+    size_t max_response; // Buffered calls: head plus body; more fails with UPSTREAM_TOO_LARGE
+    UpstreamMode mode;
+    NetAddr addr;
+    char label[INET6_ADDRSTRLEN + 8]; // ip:port for logs
+    UpstreamHost* host;
+    UpstreamConn* uc;
+    CallPhase phase;
+    int reused;     // Running on a pooled socket
+    int fresh_only; // Retrying after a pooled socket turned out dead
+    int got_bytes;
+    char* request;      // Head (or whole request), owned
+    size_t request_len;
+    const char* body;   // Borrowed from the client's in_buf, untouched while proxying
+    size_t body_len;
+    size_t sent;        // Across request, then body
+    uint64_t phase_deadline_ms;
+    uint64_t total_deadline_ms;
+    uint64_t started_us;
+
+    // Response, parsed as it arrives; chunked bodies are decoded in place
+    // unless streaming, where the raw bytes up to pos are what gets relayed
+    UpstreamBuf in;
+    FramePhase frame;
+    FramePhase body_frame; // How the body is delimited, as found in the head
+    size_t pos;        // Parse position in the raw bytes
+    size_t out;        // End of the decoded body, never past pos
+    size_t body_start;
+    size_t chunk_left;
+    size_t content_length;
+    int status;
+    int keep_alive;
+    int relaying;      // Streaming, and the client's response head is out
+
+    UpstreamCall* next; // Host queue or ready list
+};
+
+static UpstreamHost* g_upstream_hosts[UPSTREAM_POOL_BUCKETS];
+static TimerWheel g_upstream_wheel; // Millisecond ticks
+static UpstreamCall* g_upstream_ready_head = NULL; // Queued calls whose host freed a slot
+static UpstreamCall* g_upstream_ready_tail = NULL;
+static UpstreamConn* g_upstream_reap = NULL;
+
+static void start_writing(Connection* conn);
+static void close_connection(Connection* conn);
+static int flush_response(Connection* conn);
+static void upstream_call_start(UpstreamCall* call);
+static void sync_fanout_call_done(struct SyncFanout* f, size_t index, UpstreamResult result);
+static void sync_fanout_abort(struct SyncFanout* f);
+static void sync_fanout_pump(struct SyncFanout* f);
+static void nodes_cache_fill_done(struct NodesCacheEntry* e, UpstreamResult result, UpstreamResponse* resp);
+
+// Takes ownership of `request` (malloc'd); `body`, if any, is borrowed and
+// sent after it. Returns NULL (request freed) if out of memory.
+static UpstreamCall* upstream_call_new(const NetAddr* addr, char* request, size_t request_len,
+                                       const char* body, size_t body_len, UpstreamMode mode) {
+    UpstreamCall* call = calloc(1, sizeof(UpstreamCall));
+    if (!call) {
+        free(request);
+        return NULL;
+    }
+    call->mode = mode;
+    call->addr = *addr;
+    net_addr_host_port(addr, call->label, sizeof(call->label));
+    call->request = request;
+    call->request_len = request_len;
+    call->body = body;
+    call->body_len = body_len;
+    call->max_response = MAX_HTTP_BODY_SIZE + UPSTREAM_MAX_HEADER_SIZE;
+    return call;
+}
+
+// Worker side: parks the call on the connection; the reactor starts it once
+// the handler has returned. A `body` is sent straight from the client's buffer.
+static int upstream_call_create(Connection* conn, const NetAddr* addr, char* request, size_t request_len,
+                                const char* body, size_t body_len, UpstreamMode mode, UpstreamDone done) {
+    UpstreamCall* call = upstream_call_new(addr, request, request_len, body, body_len, mode);
+    if (!call) return -1;
+    call->client = conn;
+    call->done = done;
+    conn->upstream = call;
+    return 0;
+}
+
+static void upstream_pool_init(void) {
+    timer_wheel_init(&g_upstream_wheel, monotonic_ms());
+}
+
+static void upstream_reap(void) {
+    while (g_upstream_reap) {
+        UpstreamConn* uc = g_upstream_reap;
+        g_upstream_reap = uc->next;
+        free(uc);
+    }
+}
+
+static void upstream_pool_free(void) {
+    for (int i = 0; i < UPSTREAM_POOL_BUCKETS; i++) {
+        UpstreamHost* h = g_upstream_hosts[i];
+        while (h) {
+            UpstreamHost* next_host = h->next;
+            for (UpstreamConn* uc = h->idle; uc; ) {
+                UpstreamConn* next = uc->next;
+                close(uc->fd);
+                free(uc);
+                uc = next;
+            }
+            free(h);
+            h = next_host;
+        }
+        g_upstream_hosts[i] = NULL;
+    }
+    upstream_reap();
+}
+
+static UpstreamHost* upstream_host(const NetAddr* addr) {
+    // Hash the family, port and address bytes, never the padding
+    const unsigned char* bytes;
+    size_t len;
+    if (addr->sa.ss_family == AF_INET6) {
+        bytes = (const unsigned char*)&((const struct sockaddr_in6*)&addr->sa)->sin6_addr;
+        len = sizeof(struct in6_addr);
+    } else {
+        bytes = (const unsigned char*)&((const struct sockaddr_in*)&addr->sa)->sin_addr;
+        len = sizeof(struct in_addr);
+    }
+    uint32_t hash = 2166136261u ^ (uint32_t)net_addr_port(addr) ^ ((uint32_t)addr->sa.ss_family << 16);
+    for (size_t i = 0; i < len; i++) hash = (hash ^ bytes[i]) * 16777619u;
+    UpstreamHost** bucket = &g_upstream_hosts[hash & (UPSTREAM_POOL_BUCKETS - 1)];
+    for (UpstreamHost* h = *bucket; h; h = h->next) {
+        if (net_addr_equal(&h->addr, addr)) return h;
+    }
+    UpstreamHost* h = calloc(1, sizeof(UpstreamHost));
+    if (!h) return NULL;
+    h->addr = *addr;
+    h->next = *bucket;
+    *bucket = h;
+    return h;
+}
+
+static void call_list_push(UpstreamCall** head, UpstreamCall** tail, UpstreamCall* call) {
+    call->next = NULL;
+    if (*tail) (*tail)->next = call;
+    else *head = call;
+    *tail = call;
+}
+
+static int call_list_unlink(UpstreamCall** head, UpstreamCall** tail, UpstreamCall* call) {
+    UpstreamCall* prev = NULL;
+    for (UpstreamCall* c = *head; c; prev = c, c = c->next) {
+        if (c != call) continue;
+        if (prev) prev->next = c->next;
+        else *head = c->next;
+        if (*tail == c) *tail = prev;
+        return 1;
+    }
+    return 0;
+}
+
+// A slot on the host opened up: let the oldest waiting call have it
+static void upstream_slot_freed(UpstreamHost* h) {
+    UpstreamCall* call = h->queued_head;
+    if (!call) return;
+    h->queued_head = call->next;
+    if (!h->queued_head) h->queued_tail = NULL;
+    call_list_push(&g_upstream_ready_head, &g_upstream_ready_tail, call);
+}
+
+// Closing removes the socket from the epoll set at once, but the struct is
+// only freed after the current batch of events, which may still name it
+static void upstream_conn_close(UpstreamConn* uc) {
+    close(uc->fd);
+    uc->fd = -1;
+    uc->host->open_count--;
+    upstream_slot_freed(uc->host);
+    uc->next = g_upstream_reap;
+    g_upstream_reap = uc;
+}
+
+static void upstream_conn_release(UpstreamConn* uc, int reusable) {
+    UpstreamHost* h = uc->host;
+    uc->call = NULL;
+    if (!reusable) {
+        upstream_conn_close(uc);
+        return;
+    }
+    uc->idle_since_ms = monotonic_ms();
+    uc->next = h->idle;
+    h->idle = uc;
+    if (++h->idle_count > g_config.upstream_max_idle) {
+        // Over the idle cap: drop the least recently used
+        UpstreamConn** pp = &h->idle;
+        while ((*pp)->next) pp = &(*pp)->next;
+        UpstreamConn* oldest = *pp;
+        *pp = NULL;
+        h->idle_count--;
+        upstream_conn_close(oldest);
+    } else {
+        upstream_slot_freed(h);
+    }
+}
+
+// An idle socket is only reusable if the unit has neither closed it nor sent anything unasked
+static int upstream_conn_healthy(int fd) {
+    char byte;
+    ssize_t n = recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+// Deadline for the current phase; the total deadline always applies as well
+static void upstream_arm(UpstreamCall* call, uint64_t phase_deadline_ms) {
+    call->phase_deadline_ms = phase_deadline_ms;
+    timer_wheel_cancel(&call->node);
+    timer_wheel_add(&g_upstream_wheel, &call->node,
+                    phase_deadline_ms < call->total_deadline_ms ? phase_deadline_ms : call->total_deadline_ms);
+}
+
+static void upstream_call_free(UpstreamCall* call) {
+    timer_wheel_cancel(&call->node);
+    free(call->request);
+    free(call->in.data);
+    free(call);
+}
+
+// Ends the call and hands its outcome to the client connection
+static void upstream_call_finish(UpstreamCall* call, UpstreamResult result) {
+    Connection* conn = call->client;
+    UpstreamDone done = call->done;
+    UpstreamResponse resp = { 0, NULL, 0 };
+
+    metrics_upstream_done(conn ? conn->route : call->fanout ? ROUTE_SYNC : ROUTE_NODES, result, call->started_us);
+    if (call->uc) upstream_conn_release(call->uc, result == UPSTREAM_OK && call->keep_alive);
+    call->uc = NULL;
+    if (call->relaying) {
+        // The client already has a 200 head: all that is left is to end its
+        // response normally, or cut it short so it can tell it is incomplete
+        if (result != UPSTREAM_OK) log_warn("HTTP Client Error: %s broke off a streamed response", call->label);
+        conn->upstream = NULL;
+        conn->out_body = NULL;
+        conn->out_body_len = 0;
+        upstream_call_free(call);
+        if (result == UPSTREAM_OK) start_writing(conn);
+        else close_connection(conn);
+        return;
+    }
+    if (result == UPSTREAM_OK) {
+        resp.status = call->status;
+        resp.body_len = call->out - call->body_start;
+        memmove(call->in.data, call->in.data + call->body_start, resp.body_len);
+        call->in.data[resp.body_len] = '\0';
+        resp.body = call->in.data;
+        call->in.data = NULL;
+        if (resp.status != 200) {
+            log_warn("HTTP Client Error: Target Unit returned non-200 status.");
+            free(resp.body);
+            resp.body = NULL;
+            result = UPSTREAM_FAILED;
+        }
+    } else if (result == UPSTREAM_TIMED_OUT) {
+        const char* which = call->phase_deadline_ms > call->total_deadline_ms ? "total"
+                          : call->phase <= CALL_CONNECTING ? "connect" : "first-byte";
+        log_warn("HTTP Client Error: %s missed the %s deadline", call->label, which);
+    }
+    if (call->fanout) {
+        struct SyncFanout* f = call->fanout;
+        size_t index = call->fanout_index;
+        upstream_call_free(call);
+        free(resp.body);
+        sync_fanout_call_done(f, index, result);
+        return;
+    }
+    if (call->cache) {
+        struct NodesCacheEntry* e = call->cache;
+        upstream_call_free(call);
+        nodes_cache_fill_done(e, result, &resp);
+        return;
+    }
+    conn->upstream = NULL;
+    upstream_call_free(call);
+
+    done(conn, result, &resp);
+    if (conn->out_buf) start_writing(conn);
+    else close_connection(conn);
+}
+
+// A pooled socket that fails before the unit sends anything was most likely
+// closed while idle, so the call is retried once on a fresh connection.
+static void upstream_call_fail(UpstreamCall* call) {
+    if (!call->reused || call->got_bytes) {
+        upstream_call_finish(call, UPSTREAM_FAILED);
+        return;
+    }
+    upstream_conn_close(call->uc);
+    call->uc = NULL;
+    call->fresh_only = 1;
+    call->reused = 0;
+    call->sent = 0;
+    upstream_arm(call, monotonic_ms() + g_config.connect_timeout_ms);
+    upstream_call_start(call);
+}
+
+// Reads what is available into b, growing it up to `limit` and keeping it
+// NUL-terminated. Returns bytes read, 0 on EOF, -1 with errno set otherwise.
+static ssize_t upstream_read_more(int fd, UpstreamBuf* b, size_t limit) {
+    if (b->len + 1 >= b->cap) {
+        if (b->cap >= limit) {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        size_t cap = b->cap ? b->cap * 2 : 4096;
+        if (cap > limit) cap = limit;
+        char* grown = realloc(b->data, cap);
+        if (!grown) {
+            errno = ENOMEM;
+            return -1;
+        }
+        b->data = grown;
+        b->cap = cap;
+    }
+    ssize_t n = read(fd, b->data + b->len, b->cap - 1 - b->len);
+    if (n > 0) {
+        b->len += n;
+        b->data[b->len] = '\0';
+    }
+    return n;
+}
+
+// Consumes what has been buffered. Returns 1 once the response is complete,
+// 0 if more bytes are needed, -1 if it is malformed, -2 if a buffered body
+// would not fit the call's max_response.
+static int upstream_parse(UpstreamCall* call) {
+    UpstreamBuf* b = &call->in;
+    for (;;) {
+        switch (call->frame) {
+        case FRAME_HEAD: {
+            char* end = strstr(b->data + call->pos, "\r\n\r\n");
+            if (!end) return b->len - call->pos > UPSTREAM_MAX_HEADER_SIZE ? -1 : 0;
+            const char* headers = b->data + call->pos;
+            if (sscanf(headers, "HTTP/1.%*d %d", &call->status) != 1) return -1;
+            call->pos = end + 4 - b->data;
+            if (call->status < 200) break; // Interim 1xx: the real response follows
+
+            call->keep_alive = strncmp(headers, "HTTP/1.0", 8) != 0;
+            const char* connection = find_header(headers, "Connection");
+            if (connection) call->keep_alive = strncasecmp(connection, "keep-alive", 10) == 0 ||
+                                               (call->keep_alive && strncasecmp(connection, "close", 5) != 0);
+            const char* te = find_header(headers, "Transfer-Encoding");
+            const char* cl = find_header(headers, "Content-Length");
+            call->body_start = call->out = call->pos;
+            if (call->status == 204 || call->status == 304) {
+                call->frame = FRAME_DONE;
+            } else if (te && strncasecmp(te, "chunked", 7) == 0) {
+                call->frame = FRAME_CHUNK_SIZE;
+            } else if (cl) {
+                errno = 0;
+                unsigned long long length = strtoull(cl, NULL, 10);
+                if (errno || *cl < '0' || *cl > '9') return -1; // strtoull would wrap "-1" around
+                if (call->mode == UPSTREAM_BUFFERED && length > call->max_response - UPSTREAM_MAX_HEADER_SIZE) return -2;
+                call->chunk_left = call->content_length = length;
+                call->frame = FRAME_LENGTH;
+            } else {
+                // No framing: the body runs to EOF and the socket is done afterwards
+                call->keep_alive = 0;
+                call->frame = FRAME_EOF;
+            }
+            call->body_frame = call->frame;
+            break;
+        }
+        case FRAME_LENGTH: {
+            size_t avail = b->len - call->pos;
+            size_t take = avail < call->chunk_left ? avail : call->chunk_left;
+            call->pos += take;
+            call->out = call->pos;
+            call->chunk_left -= take;
+            if (call->chunk_left) return 0;
+            call->frame = FRAME_DONE;
+            break;
+        }
+        case FRAME_CHUNK_SIZE: {
+            char* line_end = strstr(b->data + call->pos, "\r\n");
+            if (!line_end) return b->len - call->pos > 1024 ? -1 : 0;
+            const char* digits = b->data + call->pos;
+            errno = 0;
+            unsigned long long size = strtoull(digits, NULL, 16);
+            if (errno || !isxdigit((unsigned char)*digits)) return -1; // Likewise for a sign here
+            if (call->mode == UPSTREAM_BUFFERED && size > call->max_response - UPSTREAM_MAX_HEADER_SIZE - (call->out - call->body_start)) return -2;
+            call->pos = line_end + 2 - b->data;
+            call->chunk_left = size;
+            call->frame = size ? FRAME_CHUNK_DATA : FRAME_TRAILERS;
+            break;
+        }
+        case FRAME_CHUNK_DATA: {
+            size_t avail = b->len - call->pos;
+            size_t take = avail < call->chunk_left ? avail : call->chunk_left;
+            if (call->mode == UPSTREAM_BUFFERED) memmove(b->data + call->out, b->data + call->pos, take);
+            call->out += take;
+            call->pos += take;
+            call->chunk_left -= take;
+            if (call->chunk_left) return 0;
+            call->frame = FRAME_CHUNK_END;
+            break;
+        }
+        case FRAME_CHUNK_END:
+            if (b->len - call->pos < 2) return 0;
+            if (memcmp(b->data + call->pos, "\r\n", 2) != 0) return -1;
+            call->pos += 2;
+            call->frame = FRAME_CHUNK_SIZE;
+            break;
+        case FRAME_TRAILERS: {
+            // Optional trailer fields, then an empty line
+            char* line_end = strstr(b->data + call->pos, "\r\n");
+            if (!line_end) return b->len - call->pos > UPSTREAM_MAX_HEADER_SIZE ? -1 : 0;
+            int empty = line_end == b->data + call->pos;
+            call->pos = line_end + 2 - b->data;
+            if (empty) call->frame = FRAME_DONE;
+            break;
+        }
+        case FRAME_EOF:
+            call->pos = call->out = b->len;
+            return 0; // Completed by the reader at EOF
+        case FRAME_DONE:
+            if (call->pos != b->len) call->keep_alive = 0; // Bytes nobody asked for: don't trust the stream
+            return 1;
+        }
+    }
+}
+
+// Commits a streamed 200 to the client, passing the unit's framing through.
+// Without any, only closing the client connection can end the body.
+static int upstream_relay_begin(UpstreamCall* call) {
+    Connection* conn = call->client;
+    char framing[64] = "";
+    if (call->body_frame == FRAME_CHUNK_SIZE) {
+        snprintf(framing, sizeof(framing), "Transfer-Encoding: chunked\r\n");
+    } else if (call->body_frame == FRAME_LENGTH) {
+        snprintf(framing, sizeof(framing), "Content-Length: %zu\r\n", call->content_length);
+    } else {
+        conn->keep_alive = 0;
+    }
+    char* head = malloc(256);
+    if (!head) return -1;
+    int head_len = snprintf(head, 256,
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json\r\n"
+        "%s"
+        "Connection: %s\r\n\r\n",
+        framing, conn->keep_alive ? "keep-alive" : "close"
+    );
+    release_response(conn);
+    conn->out_buf = head;
+    conn->out_len = head_len;
+    conn->status = 200;
+
+    // Drop the unit's head; from here on the buffer holds raw body bytes
+    UpstreamBuf* b = &call->in;
+    memmove(b->data, b->data + call->body_start, b->len - call->body_start + 1);
+    b->len -= call->body_start;
+    call->pos -= call->body_start;
+    call->body_start = call->out = 0;
+    call->relaying = 1;
+    return 0;
+}
+
+// Receiving side of a streaming call, run on events from either socket.
+// Parsed bytes go out as client response body; once they are all written
+// the buffer is compacted. While the client lags and the buffer is full,
+// the unit is left unread until the client's EPOLLOUT resumes the relay.
+static void upstream_relay(UpstreamCall* call) {
+    Connection* conn = call->client;
+    UpstreamBuf* b = &call->in;
+    for (;;) {
+        if (call->relaying) {
+            conn->out_body = b->data;
+            conn->out_body_len = call->pos;
+            int status = flush_response(conn);
+            if (status < 0) {
+                close_connection(conn); // Aborts the call as well
+                return;
+            }
+            if (status > 0) {
+                free(conn->out_buf);
+                conn->out_buf = NULL;
+                conn->out_len = conn->out_sent = 0;
+                memmove(b->data, b->data + call->pos, b->len - call->pos + 1);
+                b->len -= call->pos;
+                call->pos = 0;
+                if (call->frame == FRAME_DONE) {
+                    upstream_call_finish(call, UPSTREAM_OK);
+                    return;
+                }
+            } else if (!call->uc || b->len + 1 >= UPSTREAM_RELAY_SIZE) {
+                return;
+            }
+        }
+        if (!call->uc) return; // The unit is done; only the client's EPOLLOUT matters now
+
+        ssize_t n = upstream_read_more(call->uc->fd, b, UPSTREAM_RELAY_SIZE);
+        if (n > 0) {
+            if (!call->got_bytes) {
+                call->got_bytes = 1;
+                upstream_arm(call, UPSTREAM_NO_DEADLINE); // Only the total deadline is left
+            }
+            int status = upstream_parse(call);
+            if (status < 0) {
+                upstream_call_finish(call, UPSTREAM_FAILED);
+                return;
+            }
+            if (!call->relaying && call->frame != FRAME_HEAD) {
+                if (call->status != 200) {
+                    log_warn("HTTP Client Error: Target Unit returned non-200 status.");
+                    upstream_call_finish(call, UPSTREAM_FAILED);
+                    return;
+                }
+                if (upstream_relay_begin(call) < 0) {
+                    upstream_call_finish(call, UPSTREAM_FAILED);
+                    return;
+                }
+            }
+            if (status > 0) {
+                // Whole response is in: hand the socket back before the client has drained
+                b->len = call->pos;
+                b->data[b->len] = '\0';
+                upstream_conn_release(call->uc, call->keep_alive);
+                call->uc = NULL;
+            }
+            continue;
+        }
+        if (n == 0) {
+            if (call->frame != FRAME_EOF) {
+                upstream_call_fail(call);
+                return;
+            }
+            call->frame = FRAME_DONE; // Unframed body: EOF ends it
+            upstream_conn_release(call->uc, 0);
+            call->uc = NULL;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return; // EPOLLIN resumes
+        upstream_call_fail(call);
+        return;
+    }
+}
+
+// Moves the call forward as far as its socket allows. `events` only
+// matters while connecting, to tell a finished connect from a pending one.
+static void upstream_call_io(UpstreamCall* call, uint32_t events) {
+    UpstreamConn* uc = call->uc;
+    if (call->phase == CALL_CONNECTING) {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(uc->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) err = errno;
+        if (err) {
+            log_warn("HTTP Client Error: Could not connect to %s", call->label);
+            upstream_call_finish(call, UPSTREAM_FAILED);
+            return;
+        }
+        call->phase = CALL_SENDING;
+        upstream_arm(call, monotonic_ms() + g_config.first_byte_timeout_ms);
+    }
+    const size_t total = call->request_len + call->body_len;
+    while (call->phase == CALL_SENDING) {
+        struct iovec iov[2];
+        struct msghdr msg = { .msg_iov = iov };
+        if (call->sent < call->request_len) {
+            iov[msg.msg_iovlen].iov_base = call->request + call->sent;
+            iov[msg.msg_iovlen++].iov_len = call->request_len - call->sent;
+        }
+        if (call->body_len > 0) {
+            size_t body_sent = call->sent > call->request_len ? call->sent - call->request_len : 0;
+            iov[msg.msg_iovlen].iov_base = (char*)call->body + body_sent;
+            iov[msg.msg_iovlen++].iov_len = call->body_len - body_sent;
+        }
+        ssize_t n = sendmsg(uc->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return; // EPOLLOUT resumes
+            upstream_call_fail(call);
+            return;
+        }
+        call->sent += n;
+        if (call->sent == total) call->phase = CALL_RECEIVING;
+    }
+    if (call->mode == UPSTREAM_STREAM) {
+        upstream_relay(call);
+        return;
+    }
+    for (;;) {
+        ssize_t n = upstream_read_more(uc->fd, &call->in, call->max_response);
+        if (n > 0) {
+            if (!call->got_bytes) {
+                call->got_bytes = 1;
+                upstream_arm(call, UPSTREAM_NO_DEADLINE); // Only the total deadline is left
+            }
+            int status = upstream_parse(call);
+            if (status > 0) {
+                upstream_call_finish(call, UPSTREAM_OK);
+                return;
+            }
+            if (status < 0) {
+                upstream_call_finish(call, status == -2 ? UPSTREAM_TOO_LARGE : UPSTREAM_FAILED);
+                return;
+            }
+            continue;
+        }
+        if (n == 0) {
+            if (call->frame == FRAME_EOF) {
+                call->out = call->pos = call->in.len;
+                upstream_call_finish(call, UPSTREAM_OK);
+            } else {
+                upstream_call_fail(call);
+            }
+            return;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return; // EPOLLIN resumes
+        if (errno == EMSGSIZE) {
+            upstream_call_finish(call, UPSTREAM_TOO_LARGE); // An unframed body outgrew the limit
+            return;
+        }
+        upstream_call_fail(call);
+        return;
+    }
+}
+
+static int upstream_connect(UpstreamCall* call) {
+    int fd = socket(call->addr.sa.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_warn("HTTP Client Error: Could not create socket");
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr*)&call->addr.sa, call->addr.len) < 0 && errno != EINPROGRESS) {
+        log_warn("HTTP Client Error: Could not connect to %s", call->label);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Puts the call on a healthy idle socket, a new one, or its host's queue
+static void upstream_call_start(UpstreamCall* call) {
+    UpstreamHost* h = call->host;
+    uint64_t now = monotonic_ms();
+    while (h->idle && !call->fresh_only) {
+        UpstreamConn* uc = h->idle;
+        h->idle = uc->next;
+        h->idle_count--;
+        if (now - uc->idle_since_ms < UPSTREAM_IDLE_MS && upstream_conn_healthy(uc->fd)) {
+            uc->call = call;
+            call->uc = uc;
+            call->reused = 1;
+            call->phase = CALL_SENDING;
+            upstream_arm(call, now + g_config.first_byte_timeout_ms);
+            upstream_call_io(call, 0);
+            return;
+        }
+        upstream_conn_close(uc);
+    }
+    if (h->open_count >= g_config.upstream_max_conns) {
+        call->phase = CALL_QUEUED; // The connect deadline keeps running
+        call_list_push(&h->queued_head, &h->queued_tail, call);
+        return;
+    }
+
+    UpstreamConn* uc = calloc(1, sizeof(UpstreamConn));
+    int fd = uc ? upstream_connect(call) : -1;
+    if (fd < 0) {
+        free(uc);
+        upstream_call_finish(call, UPSTREAM_FAILED);
+        return;
+    }
+    uc->source = EVENT_UPSTREAM;
+    uc->fd = fd;
+    uc->host = h;
+    uc->call = call;
+    h->open_count++;
+    call->uc = uc;
+    call->phase = CALL_CONNECTING;
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = uc };
+    if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        log_error("Error: epoll_ctl failed: %s", strerror(errno));
+        upstream_call_finish(call, UPSTREAM_FAILED);
+        return;
+    }
+    // Completion (even an immediate one on loopback) is reported as EPOLLOUT
+}
+
+// Reactor side of upstream_call_create: arms the deadlines and starts the call
+static void upstream_call_begin(UpstreamCall* call) {
+    uint64_t now = monotonic_ms();
+    call->started_us = monotonic_us();
+    call->total_deadline_ms = now + g_config.upstream_timeout_ms;
+    upstream_arm(call, now + g_config.connect_timeout_ms);
+    call->host = upstream_host(&call->addr);
+    if (!call->host) {
+        upstream_call_finish(call, UPSTREAM_FAILED);
+        return;
+    }
+    upstream_call_start(call);
+}
+
+// Takes a queued call off its host's queue, or off the ready list if it was already moved there
+static void upstream_call_dequeue(UpstreamCall* call) {
+    if (!call_list_unlink(&call->host->queued_head, &call->host->queued_tail, call)) {
+        call_list_unlink(&g_upstream_ready_head, &g_upstream_ready_tail, call);
+    }
+}
+
+// Drops a call whose client went away; its socket is mid-exchange and can't be reused
+static void upstream_call_abort(UpstreamCall* call) {
+    if (!call->host) {
+        // Never started
+    } else if (call->phase == CALL_QUEUED) {
+        upstream_call_dequeue(call);
+    } else if (call->uc) {
+        call->uc->call = NULL;
+        upstream_conn_close(call->uc);
+    }
+    upstream_call_free(call);
+}
+
+static void on_upstream_event(UpstreamConn* uc, uint32_t events) {
+    if (uc->fd < 0) return; // Closed earlier in this batch
+    if (uc->call) {
+        upstream_call_io(uc->call, events);
+        return;
+    }
+    // Idle: a hangup or anything unsolicited makes the socket useless
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        UpstreamConn** pp = &uc->host->idle;
+        while (*pp && *pp != uc) pp = &(*pp)->next;
+        if (*pp) {
+            *pp = uc->next;
+            uc->host->idle_count--;
+        }
+        upstream_conn_close(uc);
+    }
+}
+
+// Starts calls that were waiting for a slot which has since freed up
+static void upstream_run_ready(void) {
+    while (g_upstream_ready_head) {
+        UpstreamCall* call = g_upstream_ready_head;
+        g_upstream_ready_head = call->next;
+        if (!g_upstream_ready_head) g_upstream_ready_tail = NULL;
+        upstream_call_start(call);
+    }
+}
+
+// Fails calls past a deadline, returns milliseconds until the next one may be due
+static int expire_upstream_calls(void) {
+    TimerNode expired;
+    expired.prev = expired.next = &expired;
+    timer_wheel_advance(&g_upstream_wheel, monotonic_ms(), &expired);
+    while (expired.next != &expired) {
+        UpstreamCall* call = (UpstreamCall*)expired.next;
+        timer_wheel_cancel(&call->node);
+        if (call->phase == CALL_QUEUED) upstream_call_dequeue(call);
+        upstream_call_finish(call, UPSTREAM_TIMED_OUT);
+    }
+    upstream_run_ready();
+    int64_t next = timer_wheel_next_due(&g_upstream_wheel);
+    return next < 0 ? -1 : (int)next;
+}
+
+// --- Sync Fan-out ---
+
+// A /sync naming several units (target_units, or every online unit matching
+// target_prefix) forwards the client's body, untouched and shared by every
+// call, to all of them. The reactor keeps at most --sync-parallel calls in
+// flight and starts the next as each one ends, so a fleet push takes about
+// as long as its slowest units rather than the sum. The client gets one
+// document with a result per target once the last call is done.
+
+typedef struct {
+    char name[128];
+    NetAddr addr;
+    int done;
+    const char* error;  // NULL if synced
+    UpstreamCall* call; // While in flight
+} SyncTarget;
+
+typedef struct SyncFanout {
+    Connection* client;
+    const char* body; // Borrowed from the client's in_buf, untouched while proxying
+    size_t body_len;
+    SyncTarget* targets;
+    size_t count;
+    size_t cap;
+    size_t next;      // First target not started yet
+    size_t in_flight;
+    size_t remaining; // Targets not done yet
+    int pumping;      // Inside sync_fanout_pump: calls ending synchronously must not re-enter it
+} SyncFanout;
+
+// Worker side. `addr` is NULL for a unit that is unknown or offline; it is
+// reported as such without being called.
+static int sync_fanout_add(SyncFanout* f, const char* name, const NetAddr* addr) {
+    if (f->count == MAX_SYNC_TARGETS) return -1;
+    if (f->count == f->cap) {
+        size_t cap = f->cap ? f->cap * 2 : 16;
+        SyncTarget* grown = realloc(f->targets, cap * sizeof(SyncTarget));
+        if (!grown) return -1;
+        f->targets = grown;
+        f->cap = cap;
+    }
+    SyncTarget* t = &f->targets[f->count++];
+    memset(t, 0, sizeof(*t));
+    strncpy(t->name, name, sizeof(t->name) - 1);
+    if (addr) {
+        t->addr = *addr;
+        f->remaining++;
+    } else {
+        t->done = 1;
+        t->error = "target unit not found or offline";
+    }
+    return 0;
+}
+
+static void sync_fanout_free(SyncFanout* f) {
+    free(f->targets);
+    free(f);
+}
+
+// Drops a fan-out whose client went away, abandoning the calls in flight
+static void sync_fanout_abort(SyncFanout* f) {
+    for (size_t i = 0; i < f->count; i++) {
+        if (f->targets[i].call) upstream_call_abort(f->targets[i].call);
+    }
+    sync_fanout_free(f);
+}
+
+// All targets are done: answer the client with the per-target results
+static void sync_fanout_finish(SyncFanout* f) {
+    Connection* conn = f->client;
+    JsonOut out = { NULL, 0, 0, 0 };
+    size_t failed = 0;
+    json_out_append(&out, "{\"results\":[", 12);
+    for (size_t i = 0; i < f->count; i++) {
+        SyncTarget* t = &f->targets[i];
+        json_out_append(&out, i ? ",{\"unit_name\":" : "{\"unit_name\":", i ? 14 : 13);
+        json_out_string(&out, t->name);
+        if (t->error) {
+            failed++;
+            json_out_append(&out, ",\"error\":", 9);
+            json_out_string(&out, t->error);
+            json_out_append(&out, "}", 1);
+        } else {
+            json_out_append(&out, ",\"status\":\"sync forwarded\"}", 27);
+        }
+    }
+    char totals[96];
+    int totals_len = snprintf(totals, sizeof(totals), "],\"forwarded\":%zu,\"failed\":%zu}", f->count - failed, failed);
+    json_out_append(&out, totals, totals_len);
+    log_msg("Sync fan-out: %zu targets, %zu failed", f->count, failed);
+
+    conn->fanout = NULL;
+    sync_fanout_free(f);
+    if (out.failed) {
+        free(out.buf);
+        send_response(conn, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
+    } else {
+        send_response_shared(conn, "HTTP/1.1 200 OK", "application/json", out.buf, out.len, free, out.buf);
+    }
+    if (conn->out_buf) start_writing(conn);
+    else close_connection(conn);
+}
+
+// Starts calls until the in-flight limit is reached; answers the client once nothing is left
+static void sync_fanout_pump(SyncFanout* f) {
+    if (f->pumping) return;
+    f->pumping = 1;
+    while (f->next < f->count && f->in_flight < (size_t)g_config.sync_parallel) {
+        size_t index = f->next++;
+        SyncTarget* t = &f->targets[index];
+        if (t->done) continue;
+
+        char host[INET6_ADDRSTRLEN + 8];
+        net_addr_host_port(&t->addr, host, sizeof(host));
+        char* request = malloc(512);
+        int request_len = request ? snprintf(request, 512,
+            "POST /sync_incoming HTTP/1.1\r\n"
+            "Host: %s\r\n"
+            "Content-Type: application/json\r\n"
+            "Content-Length: %zu\r\n"
+            "Connection: keep-alive\r\n\r\n",
+            host, f->body_len
+        ) : 0;
+        UpstreamCall* call = request ? upstream_call_new(&t->addr, request, request_len, f->body, f->body_len,
+                                                         UPSTREAM_BUFFERED) : NULL;
+        if (!call) {
+            t->done = 1;
+            t->error = "out of memory";
+            f->remaining--;
+            continue;
+        }
+        call->fanout = f;
+        call->fanout_index = index;
+        t->call = call;
+        f->in_flight++;
+        upstream_call_begin(call); // May end the call (and come back here) right away
+    }
+    f->pumping = 0;
+    if (f->remaining == 0) sync_fanout_finish(f);
+}
+
+static void sync_fanout_call_done(SyncFanout* f, size_t index, UpstreamResult result) {
+    SyncTarget* t = &f->targets[index];
+    t->call = NULL;
+    t->done = 1;
+    t->error = result == UPSTREAM_OK ? NULL
+             : result == UPSTREAM_TIMED_OUT ? "target unit timed out" : "target unit did not accept sync";
+    f->in_flight--;
+    f->remaining--;
+    sync_fanout_pump(f);
+}
+
+// --- Registry Watchers ---
+
+// A GET /units/watch with nothing to return yet is parked here instead of
+// holding a worker: the reactor keeps the connection and a deadline on a
+// millisecond timer wheel. Parked watchers cost nothing until the revision
+// moves; then every one of them is answered (they all wait for the next
+// event), each in time proportional to the events it missed. Without
+// `since`, a watch answers at once with the current revision, which is
+// where a client starts before its first GET /units.
+
+typedef struct Watch {
+    TimerNode node; // First member: wheel lists hold TimerNode pointers
+    Connection* conn;
+    uint64_t since;
+    uint64_t timeout_ms;
+    struct Watch* prev; // Parked list
+    struct Watch* next;
+} Watch;
+
+static TimerWheel g_watch_wheel; // Millisecond ticks
+static Watch* g_watchers = NULL;
+static uint64_t g_watch_revision = 0; // Revision the parked watchers were last checked against
+
+// Worker side: parks the request on the connection; the reactor takes it from there
+static int watch_create(Connection* conn, uint64_t since, uint64_t timeout_ms) {
+    Watch* w = calloc(1, sizeof(Watch));
+    if (!w) return -1;
+    w->conn = conn;
+    w->since = since;
+    w->timeout_ms = timeout_ms;
+    conn->watch = w;
+    return 0;
+}
+
+static void watch_init(void) {
+    timer_wheel_init(&g_watch_wheel, monotonic_ms());
+}
+
+static void watch_unpark(Watch* w) {
+    timer_wheel_cancel(&w->node);
+    if (w->prev) w->prev->next = w->next;
+    else if (g_watchers == w) g_watchers = w->next;
+    else return; // Never parked
+    if (w->next) w->next->prev = w->prev;
+    w->prev = w->next = NULL;
+    atomic_fetch_sub(&g_watcher_count, 1);
+}
+
+// Answers the watcher with whatever the feed holds after its revision (possibly nothing)
+static void watch_respond(Watch* w) {
+    Connection* conn = w->conn;
+    watch_unpark(w);
+    conn->watch = NULL;
+    JsonOut out = { NULL, 0, 0, 0 };
+    int count = unit_feed_read(w->since, &out);
+    free(w);
+    if (count < 0) {
+        free(out.buf);
+        send_response(conn, "HTTP/1.1 410 Gone", "application/json", "{\"error\":\"revision no longer available\"}");
+    } else if (out.failed) {
+        free(out.buf);
+        send_response(conn, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
+    } else {
+        send_response_shared(conn, "HTTP/1.1 200 OK", "application/json", out.buf, out.len, free, out.buf);
+    }
+    if (conn->out_buf) start_writing(conn);
+    else close_connection(conn);
+}
+
+// Reactor side of watch_create. Counts itself before looking at the feed
+// again, so an event recorded in between either shows up here or wakes us.
+static void watch_begin(Watch* w) {
+    atomic_fetch_add(&g_watcher_count, 1);
+    w->next = g_watchers;
+    if (g_watchers) g_watchers->prev = w;
+    g_watchers = w;
+    if (atomic_load(&g_registry_generation) != w->since) {
+        watch_respond(w);
+        return;
+    }
+    timer_wheel_add(&g_watch_wheel, &w->node, monotonic_ms() + w->timeout_ms);
+}
+
+// Drops a watcher whose client went away
+static void watch_abort(Watch* w) {
+    watch_unpark(w);
+    free(w);
+}
+
+// Run after a wake-up: if the revision moved, every watcher parked before it did has news
+static void watch_notify(void) {
+    uint64_t revision = atomic_load(&g_registry_generation);
+    if (revision == g_watch_revision) return;
+    g_watch_revision = revision;
+    for (Watch* w = g_watchers, *next; w; w = next) {
+        next = w->next;
+        if (w->since != revision) watch_respond(w);
+    }
+}
+
+// Answers watchers whose timeout passed, returns milliseconds until the next one may be due
+static int expire_watches(void) {
+    TimerNode expired;
+    expired.prev = expired.next = &expired;
+    timer_wheel_advance(&g_watch_wheel, monotonic_ms(), &expired);
+    while (expired.next != &expired) watch_respond((Watch*)expired.next);
+    int64_t next = timer_wheel_next_due(&g_watch_wheel);
+    return next < 0 ? -1 : (int)next;
+}
+
+// --- Node List Cache ---
+
+// A unit's GET /nodes answer is reused for --nodes-cache-ttl, so however
+// many dashboards poll it the unit sees at most one /nodes_list call per
+// TTL. Requests that miss while that call runs wait for it instead of
+// starting their own. An answer past its TTL is still served while one
+// background call refreshes it; a failed refresh drops it, so nothing is
+// served more than one call's deadline past its TTL. Each entry remembers
+// the address it was filled from and starts over when the unit has
+// re-registered elsewhere. Answers over NODES_CACHE_MAX_BODY are not kept:
+// for one TTL that unit's requests stream straight through instead.
+// Everything here runs on the reactor thread, except nodes_wait_create.
+
+#define NODES_CACHE_BUCKETS 256 // Power of two
+#define NODES_CACHE_MAX_BODY (1024 * 1024)
+#define NODES_CACHE_IDLE_MS 60000 // Entries nobody asked for in this long are dropped
+
+typedef struct {
+    _Atomic int refs; // The entry holds one, and every response still being written
+    size_t len;
+    char* data;
+} NodesBody;
+
+typedef struct NodesCacheEntry NodesCacheEntry;
+
+typedef struct NodesWait {
+    Connection* conn;
+    char name[128];
+    NetAddr addr; // Where the handler found the unit
+    NodesCacheEntry* entry; // Set while waiting for a fill
+    struct NodesWait* prev;
+    struct NodesWait* next;
+} NodesWait;
+
+struct NodesCacheEntry {
+    char name[128];
+    NetAddr addr;        // Where body came from and fills go
+    NodesBody* body;     // Last good answer, NULL if there is none
+    uint64_t filled_ms;
+    uint64_t used_ms;
+    uint64_t stream_until_ms; // The answer was too big to keep
+    UpstreamCall* fill;  // In flight, NULL if none
+    NodesWait* waiters;
+    NodesCacheEntry* next;
+};
+
+static NodesCacheEntry* g_nodes_cache[NODES_CACHE_BUCKETS];
+static size_t g_nodes_cache_count = 0;
+static uint64_t g_nodes_cache_swept_ms = 0;
+
+static void nodes_body_release(void* arg) {
+    NodesBody* body = arg;
+    if (atomic_fetch_sub_explicit(&body->refs, 1, memory_order_acq_rel) == 1) {
+        free(body->data);
+        free(body);
+    }
+}
+
+// Worker side: parks the lookup on the connection; the reactor answers it
+static int nodes_wait_create(Connection* conn, const char* name, const NetAddr* addr) {
+    NodesWait* w = calloc(1, sizeof(NodesWait));
+    if (!w) return -1;
+    w->conn = conn;
+    snprintf(w->name, sizeof(w->name), "%s", name);
+    w->addr = *addr;
+    conn->nodes = w;
+    return 0;
+}
+
+// The GET /nodes_list request for a unit, malloc'd, or NULL if out of memory
+static char* nodes_request(const NetAddr* addr, size_t* len) {
+    char host[INET6_ADDRSTRLEN + 8];
+    net_addr_host_port(addr, host, sizeof(host));
+    char* request = malloc(512);
+    if (!request) return NULL;
+    *len = snprintf(request, 512,
+        "GET /nodes_list HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "Connection: keep-alive\r\n\r\n",
+        host
+    );
+    return request;
+}
+
+// Upstream completion for a streamed /nodes (run on the reactor). It only
+// gets here when the unit fails before a 200 head; cache misses share it.
+static void nodes_proxy_done(Connection* conn, UpstreamResult result, UpstreamResponse* resp) {
+    (void)resp;
+    if (result == UPSTREAM_TIMED_OUT) {
+        send_response(conn, "HTTP/1.1 504 Gateway Timeout", "application/json", "{\"error\":\"target unit timed out\"}");
+    } else {
+        send_response(conn, "HTTP/1.1 502 Bad Gateway", "application/json", "{\"error\":\"could not reach target unit\"}");
+    }
+}
+
+// Answers the waiter with a cached body, or with why there is none
+static void nodes_wait_respond(NodesWait* w, NodesBody* body, UpstreamResult result) {
+    Connection* conn = w->conn;
+    conn->nodes = NULL;
+    free(w);
+    if (body) {
+        atomic_fetch_add_explicit(&body->refs, 1, memory_order_relaxed);
+        send_response_shared(conn, "HTTP/1.1 200 OK", "application/json", body->data, body->len,
+                             nodes_body_release, body);
+    } else {
+        nodes_proxy_done(conn, result, NULL);
+    }
+    if (conn->out_buf) start_writing(conn);
+    else close_connection(conn);
+}
+
+// Relays the unit's answer to the waiter as if there were no cache
+static void nodes_wait_stream(NodesWait* w) {
+    Connection* conn = w->conn;
+    size_t len;
+    char* request = nodes_request(&w->addr, &len);
+    UpstreamCall* call = request ? upstream_call_new(&w->addr, request, len, NULL, 0, UPSTREAM_STREAM) : NULL;
+    conn->nodes = NULL;
+    free(w);
+    if (!call) {
+        send_response(conn, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
+        if (conn->out_buf) start_writing(conn);
+        else close_connection(conn);
+        return;
+    }
+    call->client = conn;
+    call->done = nodes_proxy_done;
+    conn->upstream = call;
+    upstream_call_begin(call);
+}
+
+static NodesCacheEntry* nodes_cache_entry(const char* name) {
+    NodesCacheEntry** bucket = &g_nodes_cache[unit_name_hash(name) & (NODES_CACHE_BUCKETS - 1)];
+    for (NodesCacheEntry* e = *bucket; e; e = e->next) {
+        if (strcmp(e->name, name) == 0) return e;
+    }
+    NodesCacheEntry* e = calloc(1, sizeof(NodesCacheEntry));
+    if (!e) return NULL;
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    e->next = *bucket;
+    *bucket = e;
+    g_nodes_cache_count++;
+    return e;
+}
+
+static void nodes_cache_drop_body(NodesCacheEntry* e) {
+    if (e->body) nodes_body_release(e->body);
+    e->body = NULL;
+}
+
+// Upstream completion for a fill: keeps the answer and hands it to every waiter
+static void nodes_cache_fill_done(NodesCacheEntry* e, UpstreamResult result, UpstreamResponse* resp) {
+    e->fill = NULL;
+    nodes_cache_drop_body(e);
+    if (result == UPSTREAM_OK) {
+        NodesBody* body = malloc(sizeof(NodesBody));
+        if (body) {
+            atomic_init(&body->refs, 1);
+            body->data = resp->body;
+            body->len = resp->body_len;
+            e->body = body;
+            e->filled_ms = monotonic_ms();
+        } else {
+            free(resp->body);
+            result = UPSTREAM_FAILED;
+        }
+    } else if (result == UPSTREAM_TOO_LARGE) {
+        log_warn("Node list from %s is too large to cache, streaming it instead", e->name);
+        e->stream_until_ms = monotonic_ms() + g_config.nodes_cache_ttl_ms;
+    }
+    NodesWait* w = e->waiters;
+    e->waiters = NULL;
+    while (w) {
+        NodesWait* next = w->next;
+        w->entry = NULL;
+        if (result == UPSTREAM_TOO_LARGE) nodes_wait_stream(w);
+        else nodes_wait_respond(w, e->body, result);
+        w = next;
+    }
+}
+
+// Starts the one call that fills or refreshes the entry
+static void nodes_cache_fill(NodesCacheEntry* e) {
+    size_t len;
+    char* request = nodes_request(&e->addr, &len);
+    UpstreamCall* call = request ? upstream_call_new(&e->addr, request, len, NULL, 0, UPSTREAM_BUFFERED) : NULL;
+    if (!call) {
+        UpstreamResponse none = { 0, NULL, 0 };
+        nodes_cache_fill_done(e, UPSTREAM_FAILED, &none);
+        return;
+    }
+    call->cache = e;
+    call->max_response = NODES_CACHE_MAX_BODY + UPSTREAM_MAX_HEADER_SIZE;
+    e->fill = call;
+    upstream_call_begin(call);
+}
+
+// Reactor side of nodes_wait_create
+static void nodes_cache_begin(NodesWait* w) {
+    uint64_t now = monotonic_ms();
+    NodesCacheEntry* e = nodes_cache_entry(w->name);
+    if (!e) {
+        nodes_wait_stream(w);
+        return;
+    }
+    e->used_ms = now;
+    if (!net_addr_equal(&e->addr, &w->addr)) {
+        // New entry, or the unit moved: nothing fetched from the old address applies
+        if (e->fill) upstream_call_abort(e->fill);
+        e->fill = NULL;
+        nodes_cache_drop_body(e);
+        e->stream_until_ms = 0;
+        e->addr = w->addr;
+    }
+    if (now < e->stream_until_ms) {
+        nodes_wait_stream(w);
+        return;
+    }
+    if (e->body) {
+        int stale = now - e->filled_ms >= (uint64_t)g_config.nodes_cache_ttl_ms;
+        nodes_wait_respond(w, e->body, UPSTREAM_OK);
+        if (stale && !e->fill) nodes_cache_fill(e);
+        return;
+    }
+    w->entry = e;
+    w->next = e->waiters;
+    if (e->waiters) e->waiters->prev = w;
+    e->waiters = w;
+    if (!e->fill) nodes_cache_fill(e);
+}
+
+// Drops a waiter whose client went away; the fill carries on for the others
+static void nodes_wait_abort(NodesWait* w) {
+    if (w->entry) {
+        if (w->prev) w->prev->next = w->next;
+        else w->entry->waiters = w->next;
+        if (w->next) w->next->prev = w->prev;
+    }
+    free(w);
+}
+
+// Drops entries nobody has asked for lately, returns milliseconds until the next sweep
+static int expire_nodes_cache(void) {
+    uint64_t now = monotonic_ms();
+    if (now - g_nodes_cache_swept_ms >= NODES_CACHE_IDLE_MS) {
+        g_nodes_cache_swept_ms = now;
+        for (int i = 0; i < NODES_CACHE_BUCKETS; i++) {
+            NodesCacheEntry** pp = &g_nodes_cache[i];
+            while (*pp) {
+                NodesCacheEntry* e = *pp;
+                if (e->fill || e->waiters || now - e->used_ms < NODES_CACHE_IDLE_MS) {
+                    pp = &e->next;
+                    continue;
+                }
+                *pp = e->next;
+                nodes_cache_drop_body(e);
+                free(e);
+                g_nodes_cache_count--;
+            }
+        }
+    }
+    if (g_nodes_cache_count == 0) return -1;
+    return (int)(g_nodes_cache_swept_ms + NODES_CACHE_IDLE_MS - now);
+}
+
+static void nodes_cache_free(void) {
+    for (int i = 0; i < NODES_CACHE_BUCKETS; i++) {
+        while (g_nodes_cache[i]) {
+            NodesCacheEntry* e = g_nodes_cache[i];
+            g_nodes_cache[i] = e->next;
+            nodes_cache_drop_body(e);
+            free(e);
+        }
+    }
+    g_nodes_cache_count = 0;
+}
+
+// --- Request Handler (runs on a worker thread) ---
+
+// Request bodies are parsed into a per-worker arena that is rewound for every
+// request instead of a malloc and free per JSON value. Unless the body is
+// still needed (a fan-out /sync forwards it), strings are decoded in place and
+// point into the request buffer, which is dropped once the request is
+// answered. A tree is valid until the thread's next parse_request_json or the
+// end of the request; handlers copy what they keep.
+#define JSON_ARENA_BLOCK (64 * 1024)
+#define JSON_ARENA_KEEP (1024 * 1024) // A worker's arena grown past this by a large body is released
+
+static __thread ctz_json_arena* t_json_arena;
+
+static ctz_json_value* parse_request_json(char* body, int keep_body, char* error_buf, size_t error_size) {
+    if (!t_json_arena && !(t_json_arena = ctz_json_arena_new(JSON_ARENA_BLOCK))) {
+        snprintf(error_buf, error_size, "out of memory");
+        return NULL;
+    }
+    ctz_json_arena_reset(t_json_arena);
+    if (keep_body) return ctz_json_parse_arena(t_json_arena, body, error_buf, error_size);
+    return ctz_json_parse_insitu(t_json_arena, body, error_buf, error_size);
+}
+
+static void trim_request_json(void) {
+    if (t_json_arena && ctz_json_arena_size(t_json_arena) > JSON_ARENA_KEEP) {
+        ctz_json_arena_free(t_json_arena);
+        t_json_arena = NULL;
+    }
+}
+
+// Upstream completion for a single-target /sync (run on the reactor)
+static void sync_proxy_done(Connection* conn, UpstreamResult result, UpstreamResponse* resp) {
+    if (result == UPSTREAM_OK) {
+        free(resp->body);
+        send_response(conn, "HTTP/1.1 200 OK", "application/json", "{\"status\":\"sync forwarded\"}");
+    } else if (result == UPSTREAM_TIMED_OUT) {
+        send_response(conn, "HTTP/1.1 504 Gateway Timeout", "application/json", "{\"error\":\"target unit timed out\"}");
+    } else {
+        send_response(conn, "HTTP/1.1 502 Bad Gateway", "application/json", "{\"error\":\"target unit did not accept sync\"}");
+    }
+}
+
+// Registers every valid entry of the array in one pass over the registry and
+// answers with one result per entry, in request order
+static void handle_register_batch(Connection* conn, const ctz_json_value* entries) {
+    size_t count = ctz_json_get_array_size(entries);
+    Registration* regs = malloc((count ? count : 1) * sizeof(Registration));
+    if (!regs) {
+        send_response(conn, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
+        return;
+    }
+    size_t valid = 0;
+    for (size_t i = 0; i < count; i++) {
+        const ctz_json_value* entry = ctz_json_get_array_element(entries, i);
+        const char* unit_name = ctz_json_get_string(ctz_json_find_object_value(entry, "unit_name"));
+        int listen_port = (int)ctz_json_get_number(ctz_json_find_object_value(entry, "listen_port"));
+        if (*unit_name && listen_port > 0) registration_prepare(&regs[valid++], unit_name, &conn->peer, listen_port);
+    }
+    if (register_units(regs, valid) < 0) {
+        free(regs);
+        send_response(conn, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
+        return;
+    }
+
+    // Valid entries were prepared in request order, so walk both lists together
+    JsonOut out = { NULL, 0, 0, 0 };
+    size_t next = 0, failed = 0;
+    json_out_append(&out, "{\"results\":[", 12);
+    for (size_t i = 0; i < count; i++) {
+        const ctz_json_value* entry = ctz_json_get_array_element(entries, i);
+        const char* unit_name = ctz_json_get_string(ctz_json_find_object_value(entry, "unit_name"));
+        int listen_port = (int)ctz_json_get_number(ctz_json_find_object_value(entry, "listen_port"));
+        const char* error = "missing unit_name or listen_port";
+        if (*unit_name && listen_port > 0) {
+            Registration* r = &regs[next++];
+            error = r->result == REGISTER_FAILED ? r->error : NULL;
+        }
+        json_out_append(&out, i ? ",{" : "{", i ? 2 : 1);
+        if (*unit_name) {
+            json_out_append(&out, "\"unit_name\":", 12);
+            json_out_string(&out, unit_name);
+            json_out_append(&out, ",", 1);
+        }
+        if (error) {
+            failed++;
+            json_out_append(&out, "\"error\":", 8);
+            json_out_string(&out, error);
+            json_out_append(&out, "}", 1);
+        } else {
+            json_out_append(&out, "\"status\":\"registered\"}", 22);
+        }
+    }
+    char totals[96];
+    int totals_len = snprintf(totals, sizeof(totals), "],\"registered\":%zu,\"failed\":%zu}", count - failed, failed);
+    json_out_append(&out, totals, totals_len);
+    free(regs);
 
-// Helper to send a simple HTTP response
-void send_response(int sock_fd, const char* status_line, const char* content_type, const char* body) {
-    char response[8192];
-    snprintf(response, sizeof(response),
-        "%s\r\n"
-        "Content-Type: %s\r\n"
-        "Content-Length: %zu\r\n"
-        "Connection: close\r\n\r\n%s",
-        status_line, content_type, strlen(body), body
-    );
-    write(sock_fd, response, strlen(response));
+    log_msg("Batch registration from %s: %zu entries, %zu failed", conn->ip_addr, count, failed);
+    if (out.failed) {
+        free(out.buf);
+        send_response(conn, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
+        return;
+    }
+    send_response_shared(conn, "HTTP/1.1 200 OK", "application/json", out.buf, out.len, free, out.buf);
 }
 
-// --- Connection Handler Thread ---
-void* handle_connection(void* arg) {
-    struct {
-        int sock_fd;
-        char ip_addr[64];
-    } conn_info;
-    
-    memcpy(&conn_info, arg, sizeof(conn_info));
-    free(arg); // Free the heap-allocated argument
+typedef struct {
+    SyncFanout* fanout;
+    const char* prefix;
+    size_t prefix_len;
+    int overflow;
+} PrefixMatch;
 
-    int sock_fd = conn_info.sock_fd;
-    char* buffer = malloc(MAX_HTTP_BODY_SIZE + 1024);//50mb Buffer
-    if (!buffer) { close(sock_fd); return NULL; }
-    char http_resp_buf[8192]; // For client requests
-    
-    ssize_t n = read(sock_fd, buffer, MAX_HTTP_BODY_SIZE + 1023);
-    if (n <= 0) {
-        close(sock_fd);
-        free(buffer);
-        return NULL;
-    }
-    buffer[n] = '\0';
-    
-    // --- Parse Request ---
-    char* saveptr_line;
-    char* method_path_line;
-    char* body = strstr(buffer, "\r\n\r\n");
+static void add_prefix_match(const Unit* u, void* arg) {
+    PrefixMatch* m = arg;
+    if (m->overflow || !atomic_load_explicit(&u->online, memory_order_relaxed) ||
+        strncmp(u->name, m->prefix, m->prefix_len) != 0) return;
+    if (sync_fanout_add(m->fanout, u->name, &u->addr) < 0) m->overflow = 1;
+}
 
-    if (body) {
-        *body = '\0';
-        body += 4;    
+// /sync to target_units (an array of names) or target_prefix (every online
+// unit whose name starts with it); the reactor runs the calls
+static void handle_sync_fanout(Connection* conn) {
+    char error_buf[128];
+    ctz_json_value* root = parse_request_json(conn->body, 1, error_buf, sizeof(error_buf));
+    if (!root) {
+        send_response(conn, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"invalid json\"}");
+        return;
     }
-    
-    method_path_line = strtok_r(buffer, "\r\n", &saveptr_line);
-    if (!method_path_line) {
-        close(sock_fd);
-        free(buffer);
-        return NULL;
+    const ctz_json_value* units = ctz_json_find_object_value(root, "target_units");
+    const ctz_json_value* prefix = ctz_json_find_object_value(root, "target_prefix");
+    SyncFanout* f = calloc(1, sizeof(SyncFanout));
+    int overflow = 0;
+
+    if (f && ctz_json_get_type(units) == CTZ_JSON_ARRAY) {
+        for (size_t i = 0; i < ctz_json_get_array_size(units) && !overflow; i++) {
+            const char* name = ctz_json_get_string(ctz_json_get_array_element(units, i));
+            char ip[64];
+            int port;
+            NetAddr addr;
+            int online = *name && find_unit(name, ip, sizeof(ip), &port, &addr) == 0;
+            overflow = sync_fanout_add(f, name, online ? &addr : NULL) < 0;
+        }
+    } else if (f && ctz_json_get_type(prefix) == CTZ_JSON_STRING) {
+        PrefixMatch match = { f, ctz_json_get_string(prefix), ctz_json_get_string_length(prefix), 0 };
+        registry_for_each(add_prefix_match, &match);
+        overflow = match.overflow;
     }
 
-    char* saveptr_method;
-    char* method = strtok_r(method_path_line, " ", &saveptr_method);
-    char* path = strtok_r(NULL, " ", &saveptr_method);
-    if (!method || !path) {
-        close(sock_fd);
-        free(buffer);
-        return NULL;
+    if (!f) {
+        send_response(conn, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
+    } else if (overflow) {
+        send_response(conn, "HTTP/1.1 413 Payload Too Large", "application/json", "{\"error\":\"too many target units\"}");
+    } else if (f->count == 0) {
+        send_response(conn, "HTTP/1.1 404 Not Found", "application/json", "{\"error\":\"target unit not found or offline\"}");
+    } else {
+        f->client = conn;
+        f->body = conn->body;
+        f->body_len = conn->body_len;
+        conn->fanout = f;
+        return;
     }
-    
+    if (f) sync_fanout_free(f);
+}
+
+static void handle_request(Connection* conn) {
+    const char* method = conn->method;
+    const char* path = conn->path;
+    char* body = conn->body_len > 0 ? conn->body : NULL;
+
     // --- Route: POST /register ---
     if (strcmp(method, "POST") == 0 && strcmp(path, "/register") == 0) {
         if (body) {
             char error_buf[128];
-            ctz_json_value* root = ctz_json_parse(body, error_buf, sizeof(error_buf));
+            ctz_json_value* root = parse_request_json(body, 0, error_buf, sizeof(error_buf));
             if (root) {
                 const char* unit_name = ctz_json_get_string(ctz_json_find_object_value(root, "unit_name"));
                 int listen_port = (int)ctz_json_get_number(ctz_json_find_object_value(root, "listen_port"));
                 
-                if (unit_name && listen_port > 0) {
-                    register_unit(unit_name, conn_info.ip_addr, listen_port);
-                    send_response(sock_fd, "HTTP/1.1 200 OK", "application/json", "{\"status\":\"registered\"}");
+                if (*unit_name && listen_port > 0) {
+                    if (register_unit(unit_name, &conn->peer, listen_port) == 0) {
+                        send_response(conn, "HTTP/1.1 200 OK", "application/json", "{\"status\":\"registered\"}");
+                    } else {
+                        send_response(conn, "HTTP/1.1 503 Service Unavailable", "application/json", "{\"error\":\"registration failed\"}");
+                    }
                 } else {
-                    send_response(sock_fd, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"missing unit_name or listen_port\"}");
+                    send_response(conn, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"missing unit_name or listen_port\"}");
                 }
-                ctz_json_free(root);
             } else {
-                send_response(sock_fd, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"invalid json\"}");
+                send_response(conn, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"invalid json\"}");
             }
         } else {
-            send_response(sock_fd, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"missing body\"}");
+            send_response(conn, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"missing body\"}");
         }
         
-    // --- Route: GET /units ---
-    } else if (strcmp(method, "GET") == 0 && strcmp(path, "/units") == 0) {
-        ctz_json_value* root = ctz_json_new_array();
-        time_t now = time(NULL);
-        
-        pthread_mutex_lock(&g_unit_list_mutex);
-        for (Unit* u = g_unit_list_head; u; u = u->next) {
-            ctz_json_value* unit_obj = ctz_json_new_object();
-            ctz_json_object_set_value(unit_obj, "name", ctz_json_new_string(u->name));
-            if (now < u->last_seen + UNIT_TIMEOUT_SECONDS) {
-                ctz_json_object_set_value(unit_obj, "status", ctz_json_new_string("online"));
+    // --- Route: POST /register/batch ---
+    } else if (strcmp(method, "POST") == 0 && strcmp(path, "/register/batch") == 0) {
+        if (body) {
+            char error_buf[128];
+            ctz_json_value* root = parse_request_json(body, 0, error_buf, sizeof(error_buf));
+            if (!root || ctz_json_get_type(root) != CTZ_JSON_ARRAY) {
+                send_response(conn, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"expected a json array of registrations\"}");
+            } else if (ctz_json_get_array_size(root) > MAX_REGISTER_BATCH) {
+                send_response(conn, "HTTP/1.1 413 Payload Too Large", "application/json", "{\"error\":\"too many registrations\"}");
             } else {
-                ctz_json_object_set_value(unit_obj, "status", ctz_json_new_string("offline"));
+                handle_register_batch(conn, root);
             }
-            ctz_json_array_push_value(root, unit_obj);
+        } else {
+            send_response(conn, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"missing body\"}");
+        }
+
+    // --- Route: GET /units/watch?since=REV&timeout=S ---
+    } else if (strcmp(method, "GET") == 0 && strncmp(path, "/units/watch", 12) == 0 && (path[12] == '\0' || path[12] == '?')) {
+        const char* since_arg = query_param(path, "since");
+        const char* timeout_arg = query_param(path, "timeout");
+        char* end = NULL;
+        uint64_t since = since_arg ? strtoull(since_arg, &end, 10) : atomic_load(&g_registry_generation);
+        long timeout = WATCH_DEFAULT_TIMEOUT_SECONDS;
+        int valid = !since_arg || (end != since_arg && (*end == '\0' || *end == '&'));
+        if (timeout_arg) {
+            timeout = strtol(timeout_arg, &end, 10);
+            valid = valid && end != timeout_arg && (*end == '\0' || *end == '&') && timeout >= 0;
+            if (timeout > WATCH_MAX_TIMEOUT_SECONDS) timeout = WATCH_MAX_TIMEOUT_SECONDS;
+        }
+
+        JsonOut out = { NULL, 0, 0, 0 };
+        int count = valid ? unit_feed_read(since, &out) : 0;
+        if (!valid) {
+            send_response(conn, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"invalid since or timeout\"}");
+        } else if (count < 0) {
+            send_response(conn, "HTTP/1.1 410 Gone", "application/json", "{\"error\":\"revision no longer available\"}");
+        } else if (out.failed) {
+            send_response(conn, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
+        } else if (count > 0 || !since_arg || timeout == 0) {
+            send_response_shared(conn, "HTTP/1.1 200 OK", "application/json", out.buf, out.len, free, out.buf);
+            out.buf = NULL;
+        } else if (watch_create(conn, since, (uint64_t)timeout * 1000) < 0) {
+            send_response(conn, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
+        }
+        free(out.buf);
+
+    // --- Route: GET /units ---
+    } else if (strcmp(method, "GET") == 0 && strcmp(path, "/units") == 0) {
+        UnitsSnapshot* snap = get_units_snapshot();
+        if (snap) {
+            send_response_shared(conn, "HTTP/1.1 200 OK", "application/json", snap->body, snap->len,
+                                 units_snapshot_release, snap);
+        } else {
+            send_response(conn, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
         }
-        pthread_mutex_unlock(&g_unit_list_mutex);
-        
-        char* json_body = ctz_json_stringify(root, 0);
-        send_response(sock_fd, "HTTP/1.1 200 OK", "application/json", json_body ? json_body : "[]");
-        if (json_body) free(json_body);
-        ctz_json_free(root);
     
     // --- Route: GET /nodes?target_unit=... ---
     } else if (strcmp(method, "GET") == 0 && strncmp(path, "/nodes?target_unit=", 19) == 0) {
         const char* target_name = path + 19;
         char target_ip[64];
         int target_port;
+        NetAddr target_addr;
         
-        if (find_unit(target_name, target_ip, sizeof(target_ip), &target_port) == 0) {
-            // Found unit, now ask it for its node list
-            char http_req[512];
-            snprintf(http_req, sizeof(http_req),
-                "GET /nodes_list HTTP/1.1\r\n"
-                "Host: %s:%d\r\n"
-                "Connection: close\r\n\r\n",
-                target_ip, target_port
-            );
-            
-            if (send_http_request(target_ip, target_port, http_req, http_resp_buf, sizeof(http_resp_buf)) == 0) {
-                // Success! Forward the body of the response
-                char* body_start = strstr(http_resp_buf, "\r\n\r\n");
-                if (body_start) {
-                    send_response(sock_fd, "HTTP/1.1 200 OK", "application/json", body_start + 4);
-                } else {
-                    send_response(sock_fd, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"invalid response from target unit\"}");
-                }
+        if (find_unit(target_name, target_ip, sizeof(target_ip), &target_port, &target_addr) == 0) {
+            // Found unit: the reactor answers from the cache or asks it for its node list
+            int failed;
+            if (g_config.nodes_cache_ttl_ms > 0) {
+                failed = nodes_wait_create(conn, target_name, &target_addr) < 0;
             } else {
-                send_response(sock_fd, "HTTP/1.1 504 Gateway Timeout", "application/json", "{\"error\":\"could not reach target unit\"}");
+                size_t req_len;
+                char* http_req = nodes_request(&target_addr, &req_len);
+                failed = !http_req || upstream_call_create(conn, &target_addr, http_req, req_len, NULL, 0,
+                                                           UPSTREAM_STREAM, nodes_proxy_done) < 0;
+            }
+            if (failed) {
+                send_response(conn, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
             }
         } else {
-            send_response(sock_fd, "HTTP/1.1 404 Not Found", "application/json", "{\"error\":\"target unit not found or offline\"}");
+            send_response(conn, "HTTP/1.1 404 Not Found", "application/json", "{\"error\":\"target unit not found or offline\"}");
         }
     
     // --- Route: POST /sync ---
     } else if (strcmp(method, "POST") == 0 && strcmp(path, "/sync") == 0) {
         if (body) {
-            char error_buf[128];
-            ctz_json_value* root = ctz_json_parse(body, error_buf, sizeof(error_buf));
-            if (root) {
-                const char* target_unit = ctz_json_get_string(ctz_json_find_object_value(root, "target_unit"));
-                
-                char target_ip[64];
-                int target_port;
-                if (target_unit && find_unit(target_unit, target_ip, sizeof(target_ip), &target_port) == 0) {
-                    char* body_to_forward = ctz_json_stringify(root, 0); 
-                    size_t body_len = strlen(body_to_forward);
-                    
-                    char* http_req = malloc(body_len + 1024); // body + 1KB for headers
-                    if (!http_req) {
-                        send_response(sock_fd, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
-                        free(body_to_forward);
-                        ctz_json_free(root);
-                        close(sock_fd);
-                        free(buffer);
-                        return NULL;
-                    }
+            // Only target_unit is needed: scan for it and forward the body byte for byte
+            char target_unit[128];
+            int found = ctz_json_scan_string_member(body, conn->body_len, "target_unit", target_unit, sizeof(target_unit));
+            if (found == -2) {
+                send_response(conn, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"invalid json\"}");
+                return;
+            }
+            if (found < 0) {
+                handle_sync_fanout(conn); // No single target: maybe a list or a prefix
+                return;
+            }
 
-                    snprintf(http_req, body_len + 1024,
-                        "POST /sync_incoming HTTP/1.1\r\n"
-                        "Host: %s:%d\r\n"
-                        "Content-Type: application/json\r\n"
-                        "Content-Length: %zu\r\n"
-                        "Connection: close\r\n\r\n%s",
-                        target_ip, target_port, body_len, body_to_forward
-                    );
-                    
-                    if (send_http_request(target_ip, target_port, http_req, http_resp_buf, sizeof(http_resp_buf)) == 0) {
-                        send_response(sock_fd, "HTTP/1.1 200 OK", "application/json", "{\"status\":\"sync forwarded\"}");
-                    } else {
-                        send_response(sock_fd, "HTTP/1.1 504 Gateway Timeout", "application/json", "{\"error\":\"target unit did not accept sync\"}");
-                    }
-                    free(body_to_forward);
-                } else {
-                    send_response(sock_fd, "HTTP/1.1 404 Not Found", "application/json", "{\"error\":\"target unit not found or offline\"}");
+            char target_ip[64];
+            int target_port;
+            NetAddr target_addr;
+            if (find_unit(target_unit, target_ip, sizeof(target_ip), &target_port, &target_addr) == 0) {
+                char host[INET6_ADDRSTRLEN + 8];
+                net_addr_host_port(&target_addr, host, sizeof(host));
+                char* http_req = malloc(512);
+                int req_len = http_req ? snprintf(http_req, 512,
+                    "POST /sync_incoming HTTP/1.1\r\n"
+                    "Host: %s\r\n"
+                    "Content-Type: application/json\r\n"
+                    "Content-Length: %zu\r\n"
+                    "Connection: keep-alive\r\n\r\n",
+                    host, conn->body_len
+                ) : 0;
+
+                if (!http_req || upstream_call_create(conn, &target_addr, http_req, req_len,
+                                                      body, conn->body_len, UPSTREAM_BUFFERED, sync_proxy_done) < 0) {
+                    send_response(conn, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
                 }
-                ctz_json_free(root);
             } else {
-                send_response(sock_fd, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"invalid json\"}");
+                send_response(conn, "HTTP/1.1 404 Not Found", "application/json", "{\"error\":\"target unit not found or offline\"}");
             }
         } else {
-            send_response(sock_fd, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"missing body\"}");
+            send_response(conn, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"missing body\"}");
         }
 
     
@@ -386,117 +3599,825 @@ void* handle_connection(void* arg) {
         int target_port;
         
         // Decode URL encoding (simple space replacement for now)
-        char decoded_name[128];
+        char decoded_name[128] = {0};
         strncpy(decoded_name, target_name, sizeof(decoded_name)-1);
         for(int i=0; decoded_name[i]; i++) if(decoded_name[i] == '+') decoded_name[i] = ' ';
 
-        if (find_unit(decoded_name, target_ip, sizeof(target_ip), &target_port) == 0) {
+        if (find_unit(decoded_name, target_ip, sizeof(target_ip), &target_port, NULL) == 0) {
             char json_resp[256];
             snprintf(json_resp, sizeof(json_resp), "{\"ip\": \"%s\", \"port\": %d}", target_ip, target_port);
-            send_response(sock_fd, "HTTP/1.1 200 OK", "application/json", json_resp);
+            send_response(conn, "HTTP/1.1 200 OK", "application/json", json_resp);
+        } else {
+            send_response(conn, "HTTP/1.1 404 Not Found", "application/json", "{\"error\":\"unit not found\"}");
+        }
+    // --- Route: GET /metrics ---
+    } else if (strcmp(method, "GET") == 0 && strcmp(path, "/metrics") == 0) {
+        JsonOut out = { NULL, 0, 0, 0 };
+        metrics_render(&out);
+        if (out.failed) {
+            free(out.buf);
+            send_response(conn, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
         } else {
-            send_response(sock_fd, "HTTP/1.1 404 Not Found", "application/json", "{\"error\":\"unit not found\"}");
+            send_response_shared(conn, "HTTP/1.1 200 OK", "text/plain; version=0.0.4", out.buf, out.len, free, out.buf);
         }
+
         // --- Route: 404 Not Found (Default) ---
     } else {
-        send_response(sock_fd, "HTTP/1.1 404 Not Found", "application/json", "{\"error\":\"endpoint not found\"}");
+        send_response(conn, "HTTP/1.1 404 Not Found", "application/json", "{\"error\":\"endpoint not found\"}");
+    }
+}
+
+static void wake_reactor(void) {
+    uint64_t one = 1;
+    if (write(g_wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        log_error("Error: failed to wake reactor: %s", strerror(errno));
     }
-    free(buffer);
-    close(sock_fd);
+}
+
+// Hands a finished connection back to the reactor
+static void complete_connection(Connection* conn) {
+    Connection* head = atomic_load_explicit(&g_done_head, memory_order_relaxed);
+    do {
+        conn->next_done = head;
+    } while (!atomic_compare_exchange_weak_explicit(&g_done_head, &head, conn,
+                                                    memory_order_release, memory_order_relaxed));
+    wake_reactor();
+}
+
+// --- Worker Pool ---
+
+// Bounded MPMC ring (Vyukov): each slot carries a sequence number telling
+// producers and consumers whose turn it is, so neither side takes a lock.
+typedef struct {
+    _Atomic size_t seq;
+    Connection* conn;
+} TaskSlot;
+
+typedef struct {
+    TaskSlot* slots;
+    size_t mask;
+    _Alignas(64) _Atomic size_t enqueue_pos;
+    _Alignas(64) _Atomic size_t dequeue_pos;
+    sem_t available; // Counts queued tasks; idle workers sleep here
+} TaskQueue;
+
+static TaskQueue g_task_queue;
+static pthread_t* g_workers = NULL;
+static int g_worker_count = 0;
+static volatile int g_workers_running = 1;
+
+static int task_queue_init(TaskQueue* q, size_t depth) {
+    size_t size = 2; // The sequence scheme needs at least two slots to tell full from empty
+    while (size < depth) size <<= 1;
+    q->slots = calloc(size, sizeof(TaskSlot));
+    if (!q->slots) return -1;
+    for (size_t i = 0; i < size; i++) atomic_init(&q->slots[i].seq, i);
+    q->mask = size - 1;
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    return sem_init(&q->available, 0, 0);
+}
+
+// Returns -1 without blocking when the ring is full
+static int task_queue_push(TaskQueue* q, Connection* conn) {
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        TaskSlot* slot = &q->slots[pos & q->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                slot->conn = conn;
+                atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+                sem_post(&q->available);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1; // Full
+        } else {
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+static Connection* task_queue_pop(TaskQueue* q) {
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    for (;;) {
+        TaskSlot* slot = &q->slots[pos & q->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                Connection* conn = slot->conn;
+                atomic_store_explicit(&slot->seq, pos + q->mask + 1, memory_order_release);
+                return conn;
+            }
+        } else if (diff < 0) {
+            return NULL; // Empty
+        } else {
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+static void* worker_thread(void* arg) {
+    (void)arg;
+    for (;;) {
+        while (sem_wait(&g_task_queue.available) != 0 && errno == EINTR) {}
+        if (!g_workers_running) break;
+
+        // The semaphore guarantees a published task, but a producer may still be
+        // finishing its slot write; spin until it lands.
+        Connection* conn;
+        while (!(conn = task_queue_pop(&g_task_queue))) sched_yield();
+
+        handle_request(conn);
+        trim_request_json();
+        complete_connection(conn);
+    }
+    ctz_json_arena_free(t_json_arena);
     return NULL;
 }
 
+static int start_worker_pool(void) {
+    g_worker_count = g_config.worker_count;
+    if (g_worker_count <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        g_worker_count = cores > 0 ? (int)cores : 1;
+        if (g_worker_count > MAX_WORKER_THREADS) g_worker_count = MAX_WORKER_THREADS;
+    }
+    if (task_queue_init(&g_task_queue, (size_t)g_config.queue_depth) < 0) return -1;
+
+    g_workers = calloc(g_worker_count, sizeof(pthread_t));
+    if (!g_workers) return -1;
+    for (int i = 0; i < g_worker_count; i++) {
+        if (pthread_create(&g_workers[i], NULL, worker_thread, NULL) != 0) {
+            g_worker_count = i;
+            return -1;
+        }
+    }
+    log_msg("Worker pool started: %d workers, queue depth %zu", g_worker_count, g_task_queue.mask + 1);
+    return 0;
+}
+
+static void stop_worker_pool(void) {
+    g_workers_running = 0;
+    for (int i = 0; i < g_worker_count; i++) sem_post(&g_task_queue.available);
+    for (int i = 0; i < g_worker_count; i++) pthread_join(g_workers[i], NULL);
+    free(g_workers);
+    free(g_task_queue.slots);
+    sem_destroy(&g_task_queue.available);
+}
+
+// --- Reactor ---
+
+// The idle timeout is the same for every connection, so keeping the list in
+// activity order makes both touching and expiring O(1) per connection.
+static void idle_list_remove(Connection* conn) {
+    if (conn->idle_prev) conn->idle_prev->idle_next = conn->idle_next;
+    else if (g_idle_head == conn) g_idle_head = conn->idle_next;
+    else return; // Not on the list
+    if (conn->idle_next) conn->idle_next->idle_prev = conn->idle_prev;
+    else g_idle_tail = conn->idle_prev;
+    conn->idle_prev = conn->idle_next = NULL;
+}
+
+static void idle_list_touch(Connection* conn) {
+    idle_list_remove(conn);
+    conn->last_active_ms = monotonic_ms();
+    conn->idle_prev = g_idle_tail;
+    if (g_idle_tail) g_idle_tail->idle_next = conn;
+    else g_idle_head = conn;
+    g_idle_tail = conn;
+}
+
+// The struct outlives the socket until reap_closed(): later events in the
+// same epoll batch may still point at it
+static void close_connection(Connection* conn) {
+    idle_list_remove(conn);
+    if (conn->upstream) upstream_call_abort(conn->upstream);
+    conn->upstream = NULL;
+    if (conn->watch) watch_abort(conn->watch);
+    conn->watch = NULL;
+    if (conn->fanout) sync_fanout_abort(conn->fanout);
+    conn->fanout = NULL;
+    if (conn->nodes) nodes_wait_abort(conn->nodes);
+    conn->nodes = NULL;
+    close(conn->sock_fd); // Also removes it from the epoll set
+    metric_add(&metrics_shard()->connections_closed, 1);
+    buffer_pool_put(conn->in_buf, conn->in_cap);
+    conn->in_buf = NULL;
+    release_response(conn);
+    conn->state = CONN_CLOSED;
+    conn->next_done = g_closed_head;
+    g_closed_head = conn;
+}
+
+static void reap_closed(void) {
+    while (g_closed_head) {
+        Connection* conn = g_closed_head;
+        g_closed_head = conn->next_done;
+        free(conn);
+    }
+    upstream_reap();
+}
+
+// Moves the buffered bytes into a pooled buffer of at least min_size bytes
+static int resize_input(Connection* conn, size_t min_size) {
+    size_t cap;
+    char* buf = buffer_pool_get(min_size, &cap);
+    if (!buf) return -1;
+    memcpy(buf, conn->in_buf, conn->in_len + 1);
+    buffer_pool_put(conn->in_buf, conn->in_cap);
+    conn->in_buf = buf;
+    conn->in_cap = cap;
+    return 0;
+}
+
+// Case-insensitive lookup of a header value inside the header block
+// Looks for the end of the headers and the declared body length.
+// Returns 1 when a full request is buffered, 0 if more bytes are needed,
+// -1 with a response queued if the request must be rejected.
+static int parse_request(Connection* conn) {
+    if (conn->header_len == 0) {
+        char* end = strstr(conn->in_buf, "\r\n\r\n");
+        if (!end) {
+            if (conn->in_len > MAX_HEADER_SIZE) {
+                conn->keep_alive = 0;
+                send_response(conn, "HTTP/1.1 431 Request Header Fields Too Large", "application/json", "{\"error\":\"headers too large\"}");
+                return -1;
+            }
+            return 0;
+        }
+        conn->header_len = (end - conn->in_buf) + 4;
+
+        // HTTP/1.1 defaults to persistent connections, HTTP/1.0 has to ask for one.
+        // The request line is measured before the terminator is cut, since
+        // without headers its CRLF is the first half of "\r\n\r\n"
+        size_t request_line_len = strcspn(conn->in_buf, "\r\n");
+        int http10 = request_line_len >= 8 &&
+                     strncmp(conn->in_buf + request_line_len - 8, "HTTP/1.0", 8) == 0;
+        *end = '\0'; // Terminate the header block for the lookups below
+        const char* connection = find_header(conn->in_buf, "Connection");
+        if (connection && strncasecmp(connection, "close", 5) == 0) conn->keep_alive = 0;
+        else if (http10) conn->keep_alive = connection && strncasecmp(connection, "keep-alive", 10) == 0;
+        else conn->keep_alive = 1;
+        if (conn->requests_served + 1 >= g_config.max_requests_per_conn) conn->keep_alive = 0;
+
+        // Only Content-Length framing is understood. A chunked body left in the
+        // buffer would be read as the next pipelined request, so refuse it and close
+        if (find_header(conn->in_buf, "Transfer-Encoding")) {
+            conn->keep_alive = 0;
+            send_response(conn, "HTTP/1.1 501 Not Implemented", "application/json", "{\"error\":\"transfer-encoding not supported\"}");
+            return -1;
+        }
+
+        const char* cl = find_header(conn->in_buf, "Content-Length");
+        if (cl) {
+            char* cl_end;
+            errno = 0;
+            unsigned long long len = strtoull(cl, &cl_end, 10);
+            // strtoull would take a sign and wrap "-1" around, so insist on digits
+            if (errno || *cl < '0' || *cl > '9' || (*cl_end != '\0' && *cl_end != '\r')) {
+                conn->keep_alive = 0;
+                send_response(conn, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"invalid content-length\"}");
+                return -1;
+            }
+            if (len > MAX_HTTP_BODY_SIZE) {
+                conn->keep_alive = 0;
+                send_response(conn, "HTTP/1.1 413 Payload Too Large", "application/json", "{\"error\":\"body too large\"}");
+                return -1;
+            }
+            conn->content_length = (size_t)len;
+        }
+
+        // Move straight to the size class that fits the whole request, so the
+        // body arrives without further copies
+        size_t needed = conn->header_len + conn->content_length + 1;
+        if (needed > conn->in_cap && resize_input(conn, needed) < 0) {
+            conn->keep_alive = 0;
+            send_response(conn, "HTTP/1.1 500 Server Error", "application/json", "{\"error\":\"out of memory\"}");
+            return -1;
+        }
+    }
+
+    if (conn->in_len < conn->header_len + conn->content_length) return 0;
+
+    // Full request is in: split the request line and terminate the body
+    char* saveptr;
+    conn->method = strtok_r(conn->in_buf, " ", &saveptr);
+    conn->path = strtok_r(NULL, " \r\n", &saveptr);
+    if (!conn->method || !conn->path) {
+        conn->keep_alive = 0;
+        send_response(conn, "HTTP/1.1 400 Bad Request", "application/json", "{\"error\":\"malformed request line\"}");
+        return -1;
+    }
+    conn->body = conn->in_buf + conn->header_len;
+    conn->body_len = conn->content_length;
+    conn->saved_byte = conn->body[conn->body_len];
+    conn->body[conn->body_len] = '\0';
+    return 1;
+}
+
+// Drops the request that was just answered and slides any pipelined bytes to the front
+static void reset_for_next_request(Connection* conn) {
+    size_t consumed = conn->header_len + conn->content_length;
+    conn->in_buf[consumed] = conn->saved_byte;
+    conn->in_len -= consumed;
+    memmove(conn->in_buf, conn->in_buf + consumed, conn->in_len);
+    conn->in_buf[conn->in_len] = '\0';
+
+    // Hand a large body's buffer back to the pool before the next (usually small) request
+    if (conn->in_cap > HEADER_BUFFER_SIZE && conn->in_len < HEADER_BUFFER_SIZE) {
+        resize_input(conn, HEADER_BUFFER_SIZE); // Keeps the big buffer if this fails
+    }
+
+    conn->header_len = 0;
+    conn->content_length = 0;
+    conn->method = conn->path = conn->body = NULL;
+    conn->body_len = 0;
+    release_response(conn);
+    conn->requests_served++;
+    conn->state = CONN_READING;
+}
+
+// Flushes as much of the response as the socket accepts.
+// Returns 1 when done, 0 if the socket is full, -1 on error.
+static int flush_response(Connection* conn) {
+    size_t total = conn->out_len + conn->out_body_len;
+    while (conn->out_sent < total) {
+        struct iovec iov[2];
+        int iovcnt = 0;
+        if (conn->out_sent < conn->out_len) {
+            iov[iovcnt].iov_base = conn->out_buf + conn->out_sent;
+            iov[iovcnt++].iov_len = conn->out_len - conn->out_sent;
+        }
+        if (conn->out_body_len > 0) {
+            size_t body_sent = conn->out_sent > conn->out_len ? conn->out_sent - conn->out_len : 0;
+            iov[iovcnt].iov_base = (char*)conn->out_body + body_sent;
+            iov[iovcnt++].iov_len = conn->out_body_len - body_sent;
+        }
+        ssize_t n = writev(conn->sock_fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        conn->out_sent += n;
+        metric_add(&metrics_shard()->bytes_out, n);
+    }
+    return 1;
+}
+
+static void process_input(Connection* conn);
+
+static void continue_writing(Connection* conn) {
+    int status = flush_response(conn);
+    if (status == 0) {
+        idle_list_touch(conn);
+        return; // EPOLLOUT resumes the flush once the socket drains
+    }
+    if (status > 0) metrics_request_done(conn->route, conn->status, conn->request_started_us);
+    if (status < 0 || !conn->keep_alive) {
+        close_connection(conn);
+        return;
+    }
+    reset_for_next_request(conn);
+    idle_list_touch(conn);
+    process_input(conn); // A pipelined request may already be buffered
+}
+
+static void start_writing(Connection* conn) {
+    conn->state = CONN_WRITING;
+    continue_writing(conn);
+}
+
+static void dispatch_request(Connection* conn) {
+    idle_list_remove(conn); // Busy connections are not idle, however long the handler takes
+    conn->state = CONN_DISPATCHED;
+    if (task_queue_push(&g_task_queue, conn) < 0) {
+        // Every worker is busy and the queue is full: shed instead of piling up
+        conn->keep_alive = 0;
+        send_response(conn, "HTTP/1.1 503 Service Unavailable", "application/json", "{\"error\":\"server busy\"}");
+        start_writing(conn);
+    }
+}
+
+// Parses whatever is buffered and reads more until a request is complete or the socket is drained
+static void process_input(Connection* conn) {
+    for (;;) {
+        if (conn->in_len > 0) {
+            int status = parse_request(conn);
+            if (status != 0) {
+                conn->route = metrics_route(conn->method, conn->path); // Rejected requests have no method yet
+                conn->request_started_us = monotonic_us();
+            }
+            if (status < 0) { start_writing(conn); return; }
+            if (status > 0) { dispatch_request(conn); return; }
+        }
+
+        // Still in the headers and out of room: step up one size class
+        if (conn->header_len == 0 && conn->in_len + 1 >= conn->in_cap &&
+            resize_input(conn, conn->in_cap * 2) < 0) {
+            close_connection(conn);
+            return;
+        }
+        size_t room = conn->in_cap - conn->in_len - 1;
+        if (room == 0) return; // Request fully buffered; the rest waits for the next cycle
+
+        ssize_t n = read(conn->sock_fd, conn->in_buf + conn->in_len, room);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            close_connection(conn);
+            return;
+        }
+        if (n == 0) {
+            close_connection(conn); // Client hung up (between requests, or mid-request)
+            return;
+        }
+        conn->in_len += n;
+        conn->in_buf[conn->in_len] = '\0';
+        metric_add(&metrics_shard()->bytes_in, n);
+        idle_list_touch(conn);
+    }
+}
+
+static void on_connection_event(Connection* conn, uint32_t events) {
+    if (conn->state == CONN_CLOSED) return;
+    if (conn->state == CONN_DISPATCHED) {
+        // The worker still owns the buffers; remember the hangup for later.
+        // Pipelined bytes are picked up once the response has been written.
+        if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) conn->peer_closed = 1;
+        return;
+    }
+    // A plain FIN only shows up as EPOLLRDHUP. A parked watcher or an upstream
+    // call has nobody left to answer; while reading, the request is parsed
+    // first and the read sees EOF
+    if ((events & (EPOLLHUP | EPOLLERR)) ||
+        ((events & EPOLLRDHUP) && (conn->state == CONN_WATCHING || conn->state == CONN_PROXYING))) {
+        close_connection(conn); // Also abandons an upstream call in flight
+        return;
+    }
+    if (conn->state == CONN_READING && (events & EPOLLIN)) {
+        process_input(conn);
+    } else if (conn->state == CONN_WRITING && (events & EPOLLOUT)) {
+        continue_writing(conn);
+    } else if (conn->state == CONN_PROXYING && (events & EPOLLOUT) && conn->upstream && conn->upstream->relaying) {
+        upstream_relay(conn->upstream);
+    }
+}
+
+static void accept_connections(int server_fd) {
+    for (;;) {
+        struct sockaddr_storage client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_sock = accept4(server_fd, (struct sockaddr*)&client_addr, &client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if (client_sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EWOULDBLOCK && errno != EAGAIN && g_keep_running) {
+                log_error("Error: accept failed: %s", strerror(errno));
+            }
+            return; // Backlog drained (or out of descriptors until the next edge)
+        }
+
+        Connection* conn = calloc(1, sizeof(Connection));
+        size_t in_cap = 0;
+        char* in_buf = conn ? buffer_pool_get(HEADER_BUFFER_SIZE, &in_cap) : NULL;
+        if (!conn || !in_buf) {
+            log_error("Error: malloc failed for connection. Dropping connection.");
+            free(conn);
+            close(client_sock);
+            continue;
+        }
+        conn->source = EVENT_CLIENT;
+        conn->sock_fd = client_sock;
+        conn->state = CONN_READING;
+        conn->in_buf = in_buf;
+        conn->in_cap = in_cap;
+        conn->in_buf[0] = '\0';
+        net_addr_set(&conn->peer, (struct sockaddr*)&client_addr, client_len);
+        net_addr_ip(&conn->peer, conn->ip_addr, sizeof(conn->ip_addr));
+
+        log_sampled("Accepted connection from %s", conn->ip_addr);
+        metric_add(&metrics_shard()->connections_opened, 1);
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = conn };
+        if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, client_sock, &ev) < 0) {
+            log_error("Error: epoll_ctl failed: %s", strerror(errno));
+            close_connection(conn);
+            continue;
+        }
+        idle_list_touch(conn);
+        // Data may already be waiting; edge-triggered mode won't report it twice
+        process_input(conn);
+    }
+}
+
+// Picks up responses finished by workers
+static void drain_completions(void) {
+    uint64_t counter;
+    while (read(g_wake_fd, &counter, sizeof(counter)) > 0) {}
+
+    Connection* list = atomic_exchange_explicit(&g_done_head, NULL, memory_order_acquire);
+    while (list) {
+        Connection* conn = list;
+        list = list->next_done;
+        if (conn->peer_closed || (!conn->out_buf && !conn->upstream && !conn->watch && !conn->fanout && !conn->nodes)) {
+            close_connection(conn);
+        } else if (conn->upstream) {
+            conn->state = CONN_PROXYING;
+            upstream_call_begin(conn->upstream);
+        } else if (conn->fanout) {
+            conn->state = CONN_PROXYING;
+            sync_fanout_pump(conn->fanout);
+        } else if (conn->nodes) {
+            conn->state = CONN_PROXYING;
+            nodes_cache_begin(conn->nodes);
+        } else if (conn->watch) {
+            conn->state = CONN_WATCHING;
+            watch_begin(conn->watch);
+        } else {
+            start_writing(conn);
+        }
+    }
+    watch_notify(); // Unit events wake the reactor too
+}
+
+// Closes connections idle past the timeout, returns milliseconds until the next one is due
+static int expire_idle_connections(void) {
+    uint64_t timeout_ms = (uint64_t)g_config.idle_timeout_seconds * 1000;
+    uint64_t now = monotonic_ms();
+    while (g_idle_head && now - g_idle_head->last_active_ms >= timeout_ms) {
+        close_connection(g_idle_head);
+    }
+    if (!g_idle_head) return -1;
+    return (int)(g_idle_head->last_active_ms + timeout_ms - now);
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options]\n"
+           "  -p, --port N          Port to listen on (default: %d)\n"
+           "  -w, --workers N       Worker threads (default: one per core)\n"
+           "  -q, --queue-depth N   Requests queued for workers before shedding with 503 (default: %d)\n"
+           "  -i, --idle-timeout S  Close keep-alive connections idle for S seconds (default: %d)\n"
+           "  -r, --max-requests N  Requests served per connection before closing it (default: %d)\n"
+           "  -g, --offline-grace S Evict units that have been offline for S seconds (default: %d)\n"
+           "  -k, --upstream-idle N Idle connections kept open per unit (default: %d)\n"
+           "  -c, --upstream-conns N Connections open per unit at most (default: %d)\n"
+           "  -T, --connect-timeout MS    Deadline to connect to a unit (default: %d)\n"
+           "  -F, --first-byte-timeout MS Deadline for a unit to start answering (default: %d)\n"
+           "  -U, --upstream-timeout MS   Deadline for a whole call to a unit (default: %d)\n"
+           "  -P, --sync-parallel N Units a fan-out /sync calls at once (default: %d)\n"
+           "  -C, --nodes-cache-ttl MS    Reuse a unit's node list for MS, 0 to disable (default: %d)\n"
+           "  -L, --log-level LEVEL debug, info, warn or error (default: info)\n"
+           "  -S, --log-sample N    Keep one in N per-request debug records (default: %d)\n"
+           "  -h, --help            Show this help\n",
+           prog, COORDINATOR_PORT, DEFAULT_QUEUE_DEPTH, DEFAULT_IDLE_TIMEOUT_SECONDS, DEFAULT_MAX_REQUESTS_PER_CONN,
+           DEFAULT_OFFLINE_GRACE_SECONDS, DEFAULT_UPSTREAM_MAX_IDLE, DEFAULT_UPSTREAM_MAX_CONNS,
+           DEFAULT_CONNECT_TIMEOUT_MS, DEFAULT_FIRST_BYTE_TIMEOUT_MS, DEFAULT_UPSTREAM_TIMEOUT_MS,
+           DEFAULT_SYNC_PARALLEL, DEFAULT_NODES_CACHE_TTL_MS, DEFAULT_LOG_SAMPLE);
+}
+
+// Parses a positive integer option value, returns -1 if it is not one
+static int parse_positive_int(const char* arg) {
+    char* end;
+    errno = 0;
+    long value = strtol(arg, &end, 10);
+    if (errno || end == arg || *end != '\0' || value <= 0 || value > INT_MAX) return -1;
+    return (int)value;
+}
+
+static int parse_args(int argc, char** argv) {
+    static const struct option long_opts[] = {
+        { "port",        required_argument, NULL, 'p' },
+        { "workers",     required_argument, NULL, 'w' },
+        { "queue-depth", required_argument, NULL, 'q' },
+        { "idle-timeout", required_argument, NULL, 'i' },
+        { "max-requests", required_argument, NULL, 'r' },
+        { "offline-grace", required_argument, NULL, 'g' },
+        { "upstream-idle", required_argument, NULL, 'k' },
+        { "upstream-conns", required_argument, NULL, 'c' },
+        { "connect-timeout", required_argument, NULL, 'T' },
+        { "first-byte-timeout", required_argument, NULL, 'F' },
+        { "upstream-timeout", required_argument, NULL, 'U' },
+        { "sync-parallel", required_argument, NULL, 'P' },
+        { "nodes-cache-ttl", required_argument, NULL, 'C' },
+        { "log-level",   required_argument, NULL, 'L' },
+        { "log-sample",  required_argument, NULL, 'S' },
+        { "help",        no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:w:q:i:r:g:k:c:T:F:U:P:C:L:S:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                if ((g_config.port = parse_positive_int(optarg)) < 0 || g_config.port > 65535) {
+                    fprintf(stderr, "Invalid port: %s\n", optarg); return -1;
+                }
+                break;
+            case 'w':
+                if ((g_config.worker_count = parse_positive_int(optarg)) < 0 || g_config.worker_count > MAX_WORKER_THREADS) {
+                    fprintf(stderr, "Invalid worker count: %s\n", optarg); return -1;
+                }
+                break;
+            case 'q':
+                if ((g_config.queue_depth = parse_positive_int(optarg)) < 0) {
+                    fprintf(stderr, "Invalid queue depth: %s\n", optarg); return -1;
+                }
+                break;
+            case 'i':
+                if ((g_config.idle_timeout_seconds = parse_positive_int(optarg)) < 0) {
+                    fprintf(stderr, "Invalid idle timeout: %s\n", optarg); return -1;
+                }
+                break;
+            case 'r':
+                if ((g_config.max_requests_per_conn = parse_positive_int(optarg)) < 0) {
+                    fprintf(stderr, "Invalid request cap: %s\n", optarg); return -1;
+                }
+                break;
+            case 'g':
+                if ((g_config.offline_grace_seconds = parse_positive_int(optarg)) < 0) {
+                    fprintf(stderr, "Invalid offline grace period: %s\n", optarg); return -1;
+                }
+                break;
+            case 'k':
+                if ((g_config.upstream_max_idle = parse_positive_int(optarg)) < 0) {
+                    fprintf(stderr, "Invalid upstream idle limit: %s\n", optarg); return -1;
+                }
+                break;
+            case 'c':
+                if ((g_config.upstream_max_conns = parse_positive_int(optarg)) < 0) {
+                    fprintf(stderr, "Invalid upstream connection limit: %s\n", optarg); return -1;
+                }
+                break;
+            case 'T':
+                if ((g_config.connect_timeout_ms = parse_positive_int(optarg)) < 0) {
+                    fprintf(stderr, "Invalid connect timeout: %s\n", optarg); return -1;
+                }
+                break;
+            case 'F':
+                if ((g_config.first_byte_timeout_ms = parse_positive_int(optarg)) < 0) {
+                    fprintf(stderr, "Invalid first-byte timeout: %s\n", optarg); return -1;
+                }
+                break;
+            case 'U':
+                if ((g_config.upstream_timeout_ms = parse_positive_int(optarg)) < 0) {
+                    fprintf(stderr, "Invalid upstream timeout: %s\n", optarg); return -1;
+                }
+                break;
+            case 'P':
+                if ((g_config.sync_parallel = parse_positive_int(optarg)) < 0) {
+                    fprintf(stderr, "Invalid sync parallelism: %s\n", optarg); return -1;
+                }
+                break;
+            case 'C':
+                g_config.nodes_cache_ttl_ms = strcmp(optarg, "0") == 0 ? 0 : parse_positive_int(optarg);
+                if (g_config.nodes_cache_ttl_ms < 0) {
+                    fprintf(stderr, "Invalid node list cache TTL: %s\n", optarg); return -1;
+                }
+                break;
+            case 'L': {
+                static const char* const levels[] = { "debug", "info", "warn", "error" };
+                g_config.log_level = -1;
+                for (int i = LOG_DEBUG; i <= LOG_ERROR; i++) {
+                    if (strcmp(optarg, levels[i]) == 0) g_config.log_level = i;
+                }
+                if (g_config.log_level < 0) {
+                    fprintf(stderr, "Invalid log level: %s\n", optarg); return -1;
+                }
+                break;
+            }
+            case 'S':
+                if ((g_config.log_sample = parse_positive_int(optarg)) < 0) {
+                    fprintf(stderr, "Invalid log sample rate: %s\n", optarg); return -1;
+                }
+                break;
+            case 'h':
+                print_usage(argv[0]); exit(0);
+            default:
+                print_usage(argv[0]); return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (parse_args(argc, argv) < 0) return 1;
+    start_logger();
+    registry_init();
+    upstream_pool_init();
+    watch_init();
 
-int main() {
     signal(SIGINT, int_handler);
     signal(SIGTERM, int_handler);
     
     // Ignore SIGPIPE so we don't crash if a client disconnects
     signal(SIGPIPE, SIG_IGN); 
 
-    log_msg("Starting Exodus Coordinator on port %d...", COORDINATOR_PORT);
+    log_msg("Starting Exodus Coordinator on port %d...", g_config.port);
 
     int server_fd;
-    struct sockaddr_in address;
+    NetAddr address;
     int opt = 1;
-    socklen_t addrlen = sizeof(address);
 
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
-        log_msg("Fatal: socket failed"); return 1;
+    // Dual-stack where IPv6 is available (IPv4 peers show up as mapped addresses), IPv4 only otherwise
+    memset(&address, 0, sizeof(address));
+    if ((server_fd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) >= 0) {
+        int v6only = 0;
+        setsockopt(server_fd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only));
+        struct sockaddr_in6* in6 = (struct sockaddr_in6*)&address.sa;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_addr = in6addr_any;
+        address.len = sizeof(*in6);
+    } else if ((server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) >= 0) {
+        struct sockaddr_in* in = (struct sockaddr_in*)&address.sa;
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = INADDR_ANY;
+        address.len = sizeof(*in);
+    } else {
+        log_error("Fatal: socket failed"); return 1;
     }
+    net_addr_set_port(&address, g_config.port);
     if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
-        log_msg("Fatal: setsockopt failed"); return 1;
+        log_error("Fatal: setsockopt failed"); return 1;
     }
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(COORDINATOR_PORT);
 
-    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
-        log_msg("Fatal: bind failed on port %d", COORDINATOR_PORT); return 1;
+    if (bind(server_fd, (struct sockaddr*)&address.sa, address.len) < 0) {
+        log_error("Fatal: bind failed on port %d", g_config.port); return 1;
     }
-    if (listen(server_fd, 20) < 0) {
-        log_msg("Fatal: listen failed"); return 1;
+    if (listen(server_fd, SOMAXCONN) < 0) {
+        log_error("Fatal: listen failed"); return 1;
+    }
+
+    g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    g_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_epoll_fd < 0 || g_wake_fd < 0) {
+        log_error("Fatal: could not create epoll instance"); return 1;
+    }
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.ptr = &g_listen_tag };
+    if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) < 0) {
+        log_error("Fatal: epoll_ctl failed on listen socket"); return 1;
+    }
+    ev.data.ptr = &g_wake_tag;
+    if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, g_wake_fd, &ev) < 0) {
+        log_error("Fatal: epoll_ctl failed on wake descriptor"); return 1;
+    }
+
+    if (start_worker_pool() < 0) {
+        log_error("Fatal: could not start worker pool"); return 1;
+    }
+    if (start_expiry_thread() < 0) {
+        log_error("Fatal: could not start expiry thread"); return 1;
     }
-    
-    // Set server socket to non-blocking
-    fcntl(server_fd, F_SETFL, O_NONBLOCK);
 
     log_msg("Coordinator is live. Waiting for connections...");
 
+    struct epoll_event events[REACTOR_MAX_EVENTS];
     while (g_keep_running) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        int client_sock = accept(server_fd, (struct sockaddr*)&client_addr, &client_len);
-        
-        if (client_sock < 0) {
-            if (errno == EWOULDBLOCK || errno == EAGAIN) {
-                // No pending connections
-                sleep(1); // Wait 1 second
-            } else if (errno == EINTR) {
-                // Interrupted by signal
-                continue;
+        int timeout = expire_idle_connections();
+        int upstream_timeout = expire_upstream_calls();
+        if (upstream_timeout >= 0 && (timeout < 0 || upstream_timeout < timeout)) timeout = upstream_timeout;
+        int watch_timeout = expire_watches();
+        if (watch_timeout >= 0 && (timeout < 0 || watch_timeout < timeout)) timeout = watch_timeout;
+        int cache_timeout = expire_nodes_cache();
+        if (cache_timeout >= 0 && (timeout < 0 || cache_timeout < timeout)) timeout = cache_timeout;
+        reap_closed();
+
+        int n = epoll_wait(g_epoll_fd, events, REACTOR_MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue; // Interrupted by signal
+            log_error("Error: epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void* tag = events[i].data.ptr;
+            if (tag == &g_listen_tag) {
+                accept_connections(server_fd);
+            } else if (tag == &g_wake_tag) {
+                drain_completions();
+            } else if (*(EventSource*)tag == EVENT_UPSTREAM) {
+                on_upstream_event(tag, events[i].events);
             } else {
-                if (g_keep_running) log_msg("Error: accept failed: %s", strerror(errno));
+                on_connection_event(tag, events[i].events);
             }
-            continue;
-        }
-        
-        // --- Connection Accepted ---
-        
-        // We must pass the connection info on the heap because the loop
-        // will immediately overwrite the stack variables.
-        void* conn_info_heap = malloc(sizeof(int) + 64);
-        if (!conn_info_heap) {
-            log_msg("Error: malloc failed for conn_info. Dropping connection.");
-            close(client_sock);
-            continue;
         }
-        
-        *(int*)conn_info_heap = client_sock;
-        inet_ntop(AF_INET, &client_addr.sin_addr, (char*)conn_info_heap + sizeof(int), 64);
-        
-        log_msg("Accepted connection from %s", (char*)conn_info_heap + sizeof(int));
-        
-        pthread_t conn_thread;
-        if (pthread_create(&conn_thread, NULL, handle_connection, conn_info_heap) != 0) {
-            log_msg("Error: Failed to create connection thread");
-            close(client_sock);
-            free(conn_info_heap);
-        }
-        pthread_detach(conn_thread); // We don't need to join it
+        upstream_run_ready();
+        reap_closed();
     }
 
     close(server_fd);
     log_msg("Coordinator shutting down.");
+    stop_worker_pool();
+    stop_expiry_thread();
+    buffer_pool_drain();
+    units_snapshot_free();
+    nodes_cache_free();
+    upstream_pool_free();
     
-    // Free unit list
-    Unit* unit = g_unit_list_head;
-    while(unit) {
-        Unit* next = unit->next;
-        free(unit);
-        unit = next;
-    }
-    
-    pthread_mutex_destroy(&g_unit_list_mutex);
+    registry_free();
     return 0;
-}
\ No newline at end of file
+}
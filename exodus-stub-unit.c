@@ -0,0 +1,282 @@
+/*
+ * exodus-stub-unit.c
+ * Minimal stand-in for an Exodus unit, for benchmarking the coordinator.
+ * Answers GET /nodes_list with a fixed node list and accepts POST
+ * /sync_incoming, over keep-alive connections, one thread per connection.
+ *
+ * COMPILE:
+ * gcc -Wall -Wextra -O2 exodus-stub-unit.c -o exodus-stub-unit -pthread
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define DEFAULT_PORT 19000
+#define DEFAULT_NODE_COUNT 16
+#define MAX_REQUEST_HEAD (16 * 1024)
+
+static struct {
+    int port;
+    int port_count;
+    int node_count;
+    int delay_ms;
+} g_config = { DEFAULT_PORT, 1, DEFAULT_NODE_COUNT, 0 };
+
+static char* g_nodes_response = NULL; // Whole /nodes_list response, built once
+static size_t g_nodes_response_len = 0;
+
+static const char g_sync_response[] =
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 11\r\n"
+    "Connection: keep-alive\r\n\r\n"
+    "{\"ok\":true}";
+
+static const char g_not_found_response[] =
+    "HTTP/1.1 404 Not Found\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 2\r\n"
+    "Connection: keep-alive\r\n\r\n"
+    "{}";
+
+static int build_nodes_response(void) {
+    size_t body_cap = 16 + (size_t)g_config.node_count * 64;
+    char* body = malloc(body_cap);
+    if (!body) return -1;
+    size_t len = 0;
+    body[len++] = '[';
+    for (int i = 0; i < g_config.node_count; i++) {
+        len += snprintf(body + len, body_cap - len, "%s{\"node\":\"stub-node-%d\",\"status\":\"ready\"}",
+                        i ? "," : "", i);
+    }
+    body[len++] = ']';
+
+    size_t cap = len + 256;
+    g_nodes_response = malloc(cap);
+    if (!g_nodes_response) {
+        free(body);
+        return -1;
+    }
+    g_nodes_response_len = snprintf(g_nodes_response, cap,
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: keep-alive\r\n\r\n", len);
+    memcpy(g_nodes_response + g_nodes_response_len, body, len);
+    g_nodes_response_len += len;
+    free(body);
+    return 0;
+}
+
+static int write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Reads and discards `len` body bytes, some of which may already be buffered
+static int skip_body(int fd, char* buf, size_t* buffered, size_t len) {
+    size_t have = *buffered < len ? *buffered : len;
+    memmove(buf, buf + have, *buffered - have);
+    *buffered -= have;
+    len -= have;
+    char sink[16384];
+    while (len > 0) {
+        ssize_t n = read(fd, sink, len < sizeof(sink) ? len : sizeof(sink));
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return -1;
+        }
+        len -= n;
+    }
+    return 0;
+}
+
+static void* serve_connection(void* arg) {
+    int fd = (int)(intptr_t)arg;
+    char* buf = malloc(MAX_REQUEST_HEAD + 1);
+    size_t buffered = 0;
+    while (buf) {
+        buf[buffered] = '\0';
+        char* end = strstr(buf, "\r\n\r\n");
+        if (!end) {
+            if (buffered >= MAX_REQUEST_HEAD) break;
+            ssize_t n = read(fd, buf + buffered, MAX_REQUEST_HEAD - buffered);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            buffered += n;
+            continue;
+        }
+        size_t head_len = end - buf + 4;
+        size_t body_len = 0;
+        for (char* line = strstr(buf, "\r\n"); line && line < end; line = strstr(line + 2, "\r\n")) {
+            if (strncasecmp(line + 2, "Content-Length:", 15) == 0) body_len = strtoul(line + 17, NULL, 10);
+        }
+        int nodes = strncmp(buf, "GET /nodes_list ", 16) == 0;
+        int sync = strncmp(buf, "POST /sync_incoming ", 20) == 0;
+
+        memmove(buf, buf + head_len, buffered - head_len);
+        buffered -= head_len;
+        if (skip_body(fd, buf, &buffered, body_len) < 0) break;
+
+        if (g_config.delay_ms > 0) {
+            struct timespec delay = { g_config.delay_ms / 1000, (g_config.delay_ms % 1000) * 1000000L };
+            nanosleep(&delay, NULL);
+        }
+        int status;
+        if (nodes) status = write_all(fd, g_nodes_response, g_nodes_response_len);
+        else if (sync) status = write_all(fd, g_sync_response, sizeof(g_sync_response) - 1);
+        else status = write_all(fd, g_not_found_response, sizeof(g_not_found_response) - 1);
+        if (status < 0) break;
+    }
+    free(buf);
+    close(fd);
+    return NULL;
+}
+
+static void* accept_loop(void* arg) {
+    int server_fd = (int)(intptr_t)arg;
+    for (;;) {
+        int fd = accept(server_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            sleep(1); // Usually out of descriptors; give connections a chance to close
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connection, (void*)(intptr_t)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+static int listen_on(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void print_usage(const char* prog) {
+    printf("Usage: %s [options]\n"
+           "  -p, --port N          First port to listen on (default: %d)\n"
+           "  -n, --ports N         Listen on N consecutive ports, one unit each (default: 1)\n"
+           "  -N, --nodes N         Nodes in the /nodes_list answer (default: %d)\n"
+           "  -d, --delay-ms MS     Wait this long before every answer (default: 0)\n"
+           "  -h, --help            Show this help\n",
+           prog, DEFAULT_PORT, DEFAULT_NODE_COUNT);
+}
+
+static int parse_int(const char* arg, int min) {
+    char* end;
+    errno = 0;
+    long value = strtol(arg, &end, 10);
+    if (errno || end == arg || *end != '\0' || value < min || value > INT_MAX) return -1;
+    return (int)value;
+}
+
+static int parse_args(int argc, char** argv) {
+    static const struct option long_opts[] = {
+        { "port",     required_argument, NULL, 'p' },
+        { "ports",    required_argument, NULL, 'n' },
+        { "nodes",    required_argument, NULL, 'N' },
+        { "delay-ms", required_argument, NULL, 'd' },
+        { "help",     no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:n:N:d:h", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'p':
+                if ((g_config.port = parse_int(optarg, 1)) < 0 || g_config.port > 65535) {
+                    fprintf(stderr, "Invalid port: %s\n", optarg); return -1;
+                }
+                break;
+            case 'n':
+                if ((g_config.port_count = parse_int(optarg, 1)) < 0) {
+                    fprintf(stderr, "Invalid port count: %s\n", optarg); return -1;
+                }
+                break;
+            case 'N':
+                if ((g_config.node_count = parse_int(optarg, 0)) < 0) {
+                    fprintf(stderr, "Invalid node count: %s\n", optarg); return -1;
+                }
+                break;
+            case 'd':
+                if ((g_config.delay_ms = parse_int(optarg, 0)) < 0) {
+                    fprintf(stderr, "Invalid delay: %s\n", optarg); return -1;
+                }
+                break;
+            case 'h':
+                print_usage(argv[0]); exit(0);
+            default:
+                print_usage(argv[0]); return -1;
+        }
+    }
+    if (g_config.port + g_config.port_count - 1 > 65535) {
+        fprintf(stderr, "Port range runs past 65535\n"); return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (parse_args(argc, argv) < 0) return 1;
+    signal(SIGPIPE, SIG_IGN);
+    if (build_nodes_response() < 0) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < g_config.port_count; i++) {
+        int fd = listen_on(g_config.port + i);
+        pthread_t thread;
+        if (fd < 0) {
+            fprintf(stderr, "Could not listen on port %d: %s\n", g_config.port + i, strerror(errno));
+            return 1;
+        }
+        if (pthread_create(&thread, NULL, accept_loop, (void*)(intptr_t)fd) != 0) {
+            fprintf(stderr, "Could not start accept thread\n");
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+    fprintf(stderr, "Stub unit listening on 127.0.0.1:%d-%d\n", g_config.port, g_config.port + g_config.port_count - 1);
+    pause();
+    return 0;
+}